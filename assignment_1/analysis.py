@@ -195,7 +195,8 @@ print("Done!")
 timeFolder = root / "assignment_1" / "timeviters"
 assert timeFolder.exists()
 
-outputFiles = sorted(list(timeFolder.glob("*.dat")))
+# the *_tiles.dat files of -active-set hold tile counts, not times
+outputFiles = sorted(list(timeFolder.glob("*_.dat")))
 
 # extract arrays & metadata
 data = ()
@@ -301,12 +302,14 @@ assert timeFolder.exists()
 
 outputFiles = sorted(list(sweepFolder.glob("*.dat")))
 sweepData = {}
-idx = 0
-for i, file in enumerate(outputFiles):
-    if i % 3 == 0:
-        idx += 1
-        sweepData[idx] = {}
+for file in outputFiles:
     meta = pyutils.get_metadata(file)
+    # -adaptive-exchange also writes _messages and _stale files
+    if meta["type"] not in ("iters", "times", "sweeps"):
+        continue
+    idx = file.name.rsplit("_", 1)[0]
+    if idx not in sweepData:
+        sweepData[idx] = {}
     if meta["type"] == "iters":
         sweepData[idx]["meta"] = meta
         sweepData[idx]["iters"] = np.fromfile(file, dtype=int)
@@ -340,7 +343,8 @@ print("Done!")
 latencyFolder = root / "assignment_1" / "latency_analysis"
 assert latencyFolder.exists()
 
-outputFiles = sorted(list(latencyFolder.glob("*.dat")))
+# the *_halo.dat files hold the halo exchange calibration, not latencies
+outputFiles = sorted(list(latencyFolder.glob("*_.dat")))
 latencyData = {}
 pgrids = []
 for i, file in enumerate(outputFiles):
@@ -7,12 +7,73 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <float.h>
 #include <time.h>
 #include <mpi.h>
+#include <pthread.h>
+#include "mpifuncs.h"
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #define DEBUG 1
 
 #define max(a, b) ((a) > (b) ? a : b)
+#define min(a, b) ((a) < (b) ? a : b)
+
+/* rows per wavefront tile of the deep halo solver */
+#define DEEP_HALO_TILE 16
+
+/* multigrid: smoothing sweeps, the coarsest grid size and the number of
+   cells per direction every process keeps before the levels are gathered */
+#define MG_PRE_SWEEPS 2
+#define MG_POST_SWEEPS 2
+#define MG_COARSE_SWEEPS 50
+#define MG_COARSEST 3
+#define MG_MIN_LOCAL 4
+
+/* automatic omega: the contraction of global_delta counts as settled after
+   OMEGA_STABLE_ITERS ratios within OMEGA_RATIO_TOL * (1 - ratio) of each
+   other, estimates raising omega by less than OMEGA_MIN_CHANGE end it */
+#define OMEGA_STABLE_ITERS 5
+#define OMEGA_RATIO_TOL 0.05
+#define OMEGA_MIN_CHANGE 0.001
+
+/* mixed precision: the sweeps run on a float copy of phi until global_delta
+   drops below MIXED_SWITCH_FACTOR * precision_goal, below the rounding floor
+   MIXED_FLOOR_FACTOR * FLT_EPSILON * max|phi| / (2 - omega) of the float
+   sweep, or has not reached a new minimum for MIXED_STALL_ITERS iterations */
+#define MIXED_SWITCH_FACTOR 1.2
+#define MIXED_FLOOR_FACTOR 1.0
+#define MIXED_STALL_ITERS 200
+
+/* telemetry: records per chunk, chunks per stream and streams, the flush
+   queue holds every chunk of every stream */
+#define TELEMETRY_CHUNK 1024
+#define TELEMETRY_POOL 4
+#define TELEMETRY_STREAMS 3
+
+/* exchanges timed per backend by the -halo auto calibration */
+#define HALO_CALIBRATION_ROUNDS 20
+
+/* ping-pongs per message size and iterations timed per candidate of the
+   automatic process grid selection */
+#define PROC_GRID_PINGPONGS 20
+#define PROC_GRID_STEPS 5
+
+/* iterations timed per candidate of the -autotune search */
+#define AUTOTUNE_STEPS 5
+
+/* -active-set: tiles of ACTIVE_TILE_X rows of ACTIVE_TILE_Y points, 16 KB of
+   phi, flat so that the rows of a tile stay long */
+#define ACTIVE_TILE_X 4
+#define ACTIVE_TILE_Y 512
+
+/* problems of -batch updated together by one vector loop of Batch_Step */
+#define BATCH_LANES 4
+
+/* floating point operations of one SOR point update, for the GFLOP/s of -perf */
+#define SOR_FLOPS_PER_POINT 9
 
 enum
 {
@@ -20,11 +81,134 @@ enum
   Y_DIR
 };
 
+/* loop variants used by Do_Step (values of efficient_loop_flag) */
+enum
+{
+  NAIVE_LOOP,
+  EFFICIENT_LOOP,
+  CHECKERBOARD_LOOP
+};
+
+/* solvers (values of solver) */
+enum
+{
+  SOLVER_SOR,
+  SOLVER_VCYCLE,
+  SOLVER_FMG,
+  SOLVER_ASYNC
+};
+#define N_SOLVERS 4
+char *solver_names[] = {"sor", "vcycle", "fmg", "async"};
+
+/* storage of phi during the sweeps (values of precision) */
+enum
+{
+  PREC_DOUBLE,
+  PREC_MIXED
+};
+char *precision_names[] = {"double", "mixed"};
+
+/* backends of Exchange_Borders (values of halo_engine) */
+enum
+{
+  HALO_DATATYPE,
+  HALO_PACK,
+  HALO_PERSISTENT,
+  HALO_NEIGHBOR,
+  HALO_RMA,
+  HALO_SHARED,
+  HALO_AUTO
+};
+#define N_HALO_ENGINES HALO_AUTO
+char *halo_names[] = {"datatype", "pack", "persistent", "neighbor", "rma", "shared", "auto"};
+
+/* phases of Solve counted by -perf */
+enum
+{
+  PERF_STEP,
+  PERF_EXCHANGE
+};
+#define N_PERF_PHASES 2
+
+/* choice of the relaxation parameter (values of omega_mode) */
+enum
+{
+  OMEGA_FIXED,
+  OMEGA_AUTO,
+  OMEGA_CHEBYSHEV
+};
+
+/* directions of the halo exchange table */
+enum
+{
+  TO_TOP,
+  TO_BOTTOM,
+  TO_LEFT,
+  TO_RIGHT
+};
+
 /* global variables */
 int gridsize[2];
 double precision_goal = 0.0001; /* precision_goal of solution */
 int max_iter = 5000;            /* maximum number of iterations alowed */
 MPI_Datatype border_type[2];    /* Datatypes for vertical and horizontal exchange */
+void *halo_send_buf[4];         /* halo exchange table, one entry per direction */
+void *halo_recv_buf[4];
+MPI_Datatype halo_send_type[4];
+MPI_Datatype halo_recv_type[4];
+int halo_dest[4];
+int halo_source[4];
+MPI_Request halo_request[8]; /* requests of a nonblocking exchange */
+int halo_pending = 0;        /* TRUE while a nonblocking exchange is in flight */
+
+/* layout of the borders for the pack backend: halo_blocks blocks of
+   halo_blocklen elements halo_stride elements apart, 0 blocks if the
+   border is only described by its datatype */
+int halo_blocks[4];
+int halo_blocklen[4];
+int halo_stride[4];
+int halo_elem_size;
+
+/* colour tables: the points of colour c ((x + y + offset[X_DIR] +
+   offset[Y_DIR]) % 2 == c) of every border. The datatype backend only sends
+   those while halo_colour is c, -1 sends all */
+void *halo_colour_send_buf[2][4];
+void *halo_colour_recv_buf[2][4];
+MPI_Datatype halo_colour_send_type[2][4];
+MPI_Datatype halo_colour_recv_type[2][4];
+int halo_colour_ready = 0;
+int halo_colour = -1;
+
+/* state of the halo exchange backends, built on the first exchange after
+   the table changed */
+int halo_engine = HALO_DATATYPE;
+int halo_auto_flag = 0;     /* TRUE if halo_engine was chosen by calibration */
+int halo_ready = 0;         /* TRUE while the state below matches the table */
+int halo_send_bytes[4];
+int halo_recv_bytes[4];
+char *halo_stage = NULL;    /* contiguous borders of pack and rma, send slots then receive slots */
+int halo_stage_off[8];      /* byte offsets of send slot i and receive slot 4 + i */
+MPI_Request halo_persistent[8];
+int halo_nb_counts[2][4];   /* neighbor_alltoallw: one phase per dimension */
+MPI_Aint halo_nb_send_displs[2][4];
+MPI_Aint halo_nb_recv_displs[2][4];
+MPI_Datatype halo_nb_send_types[2][4];
+MPI_Datatype halo_nb_recv_types[2][4];
+MPI_Win halo_win;
+MPI_Group halo_group[2];    /* neighbours of each phase of the rma backend */
+MPI_Aint halo_put_disp[4];  /* receive slot of direction i in the window of halo_dest[i] */
+double halo_times[N_HALO_ENGINES]; /* seconds per exchange of each backend, from calibration */
+char *halo_peer_buf[4];     /* shared: send border of halo_source[i] in its phi, NULL if sent as a message */
+int halo_peer_stride[4];
+int halo_to_peer[4];        /* shared: TRUE if halo_dest[i] reads the border itself */
+
+/* the processes of grid_comm on this node, phi lives in a window shared
+   with them when the shared backend may be used */
+MPI_Comm node_comm;
+MPI_Win phi_win;
+char *phi_win_base;  /* part of this process, phi[0] may be swapped out by the deep halo */
+MPI_Aint phi_win_size;
+int phi_shared = 0;
 int *gridsizes;
 int grid_length = 1;
 int grid_size_idx;
@@ -37,10 +221,27 @@ int proc_top, proc_right, proc_bottom, proc_left; /* ranks of neigboring procs
 int offset[2];                                    /* offset of subgrid handled by current process */
 
 int P;              /* total number of processes */
+int n_threads = 1;   /* OpenMP threads per process */
+int max_threads = 1; /* OpenMP threads available to a process */
 int P_grid[2];      /* process grid dimensions        */
 MPI_Comm grid_comm; /* grid COMMUNICATOR        */
 MPI_Status status;
 
+/* automatic process grid: P_grid minimises the predicted time per iteration
+   of the largest grid size */
+int proc_grid_auto = 0;
+double predicted_iter_time;
+int predicted_gridsize = -1;
+
+/* ensemble: n_groups process grids of P processes each run the omega and
+   sweep configurations of a grid size concurrently */
+int n_groups = 1;
+int group = 0;             /* process grid of this process */
+MPI_Comm ensemble_comm;    /* the processes with rank proc_rank in every group */
+MPI_Win config_win;        /* per grid size the next configuration, on world rank 0 */
+int *config_counter;
+double *ensemble_results;  /* iters, wtimes, cpu_util and omegas of every configuration */
+
 /* benchmark related variables */
 clock_t ticks;    /* number of systemticks */
 double *cpu_util; /* CPU utilization */
@@ -54,9 +255,112 @@ double wtime_sum;
 
 /* local grid related variables */
 double **phi; /* grid */
-int **source; /* TRUE if subgrid element is a source */
 int dim[2];   /* grid dimensions */
 
+/* updatable points: row x consists of the spans [span_lo[k], span_hi[k]) for
+   span_ptr[x] <= k < span_ptr[x + 1], the source points are left out */
+int *span_ptr;
+int *span_lo;
+int *span_hi;
+
+/* problem as read from input.dat: n_input_src sources (x, y, value) relative
+   to the grid size */
+int n_input_src;
+double *input_src;
+
+/* setup cache: the grid of setup_gridsize (and for deep halos setup_sweep)
+   stays set up between runs, every run starts from the copy phi_init */
+int setup_gridsize = -1;
+int setup_sweep = -1;
+double *phi_init;
+
+/* -warm-start: phi of the last run on the previous grid size (local array
+   of warm_gridsize), prolongated onto the next grid size as its phi_init */
+int warm_start_flag = 0;
+int warm_gridsize = -1;
+double *warm_phi = NULL;
+
+/* -batch: batch_size problems, one per input file, solved in one run. Point
+   (x, y) of problem b is bphi[x][y * batch_stride + b], so every update runs
+   over all problems and every halo message carries all of them. The problems
+   are padded to groups of BATCH_LANES, the padding never iterates */
+int batch_size = 0;        /* 0: the problem of input.dat on phi */
+int batch_stride;
+char **batch_files;
+double **batch_problem;    /* buffer of Read_Problem of every file */
+int *batch_active;         /* TRUE while problem b iterates */
+int *batch_group_active;   /* TRUE while a problem of group g iterates */
+int *batch_iters;          /* iterations and error problem b stopped at */
+double *batch_error;
+double **bphi;
+double *bphi_init;
+int *bspan_ptr;            /* spans without the sources of any problem */
+int *bspan_lo;
+int *bspan_hi;
+int n_batch_extra;         /* (x, y, b) of the sources of other problems */
+int *batch_extra;          /* that are no source of problem b */
+MPI_Datatype batch_point_type; /* the batch_size values of one point, batch_stride apart */
+
+/* sources (fixed points) of the whole grid, in local coordinates */
+int n_src;
+int *src_x;
+int *src_y;
+double *src_val;
+
+/* checkerboard storage: red (0) and black (1) points compacted per row */
+double *cb_phi[2]; /* cb_phi[c][x * cb_stride + y / 2] */
+int cb_stride;     /* row length, padded to 64 bytes */
+
+/*
+ * Multigrid level. On level 0 u is phi, on the coarser levels the correction,
+ * b is the right hand side of 4 u - (sum of the neighbours) = b and r the
+ * residual. The cell I of a level is the union of the cells 2 I - 1 and 2 I
+ * of the next finer one and is owned by the process owning cell 2 I - 1.
+ */
+typedef struct
+{
+  int n[2];      /* global grid size */
+  int offset[2]; /* offset and dimensions of the local grid, like phi */
+  int dim[2];
+  int serial; /* level gathered on rank 0 */
+  int active; /* this process works on the level */
+  int gather; /* the next level is this one gathered on rank 0 */
+  double **u;
+  double **b; /* NULL on level 0 */
+  double **r;
+  int n_fixed; /* fixed points, in local coordinates */
+  int *fixed_x;
+  int *fixed_y;
+  double *fixed_val;
+  int *span_ptr;
+  int *span_lo;
+  int *span_hi;
+  MPI_Datatype row_type; /* a whole row x, for the horizontal exchange */
+  MPI_Datatype col_type; /* the owned points of a column y, for the vertical exchange */
+} Level;
+
+Level *levels;
+int n_levels;
+int *gather_box;         /* offset and size of every process on the gathered level, on rank 0 */
+double **rhs_phi = NULL; /* right hand side of the level Do_Step works on, NULL for phi */
+
+/* deep halo: copy of phi with halos of halo_width = 2 * sweep cells, local
+   point (x, y) is dh_phi[x + halo_width - 1][y + halo_width - 1] */
+double **dh_phi;
+int dh_dim[2];
+int dh_offset[2]; /* offset with the parity of offset, used by Do_Step_Region */
+int halo_width;
+int *dh_span_ptr;
+int *dh_span_lo;
+int *dh_span_hi;
+
+/* mixed precision: float copy of phi, NULL while the sweeps run on phi */
+float **phi_f = NULL;
+MPI_Datatype border_type_f[2];
+double mixed_phi_max; /* max|phi| when the float sweeps began */
+double mixed_best;    /* smallest global_delta of the float sweeps */
+int mixed_best_iter;  /* count at which it was reached */
+
 /* toggles */
 int benchmark_flag = 0;
 int error_flag = 0;
@@ -64,6 +368,83 @@ int track_errors = 0;
 int write_output_flag = 0;
 int efficient_loop_flag = 1;
 int latency_flag = 0;
+int overlap_flag = 0;
+int colour_halo_flag = 1;
+int deep_halo_flag = 0;
+int solver = SOLVER_SOR;
+int precision = PREC_DOUBLE;
+int check_pipelined_flag = 0;
+
+/* convergence check: the errors of check_every iterations are reduced at
+   once, with -check-pipelined the reduction completes one block later */
+int check_every = 1;
+
+/* -adaptive-exchange: instead of every sweep iterations, a process sends its
+   borders in an iteration if they would otherwise be off by more than
+   adaptive_fraction * global_delta. The decisions are exchanged with the
+   neighbours after the reduction of the error */
+double adaptive_fraction = 0.0;
+int adaptive_send;       /* this process sends this iteration */
+int adaptive_recv[4];    /* the source of direction i sends this iteration */
+int adaptive_skipped;    /* some process did not send in the last iteration */
+double *adaptive_sent;   /* the send borders at their last send */
+double *adaptive_prev;   /* the send borders after the last iteration */
+long adaptive_saved;     /* sends skipped in the current Solve, all processes after it */
+int adaptive_first;      /* first check that converged on stale halos, or 0 */
+long *messages_saved;    /* per omega of the last sweep, like iters */
+int *stale_iters;        /* iterations after the first convergence on stale halos */
+
+/* -active-set: the interior is split into tiles. A tile is only updated
+   while its own last change plus the change of its neighbouring tiles and
+   of the halo next to it since then reaches active_set_factor *
+   precision_goal, a convergence reached on a part of the tiles is
+   confirmed by an iteration over all of them */
+double active_set_factor = 0.0;
+int tile_n[2];          /* tiles per dimension */
+double *tile_delta;     /* largest change of every tile in its last update, NULL outside Solve */
+double *tile_drift;     /* change of the neighbouring tiles since that update */
+int *active_tiles;      /* tiles of the current iteration */
+int n_active_tiles;
+int active_all;         /* TRUE if the current iteration updates every tile */
+int active_verify;      /* TRUE if the next one has to */
+double *active_halo;    /* the halo next to every edge tile at its last update */
+long active_updates;    /* tile updates of the current Solve */
+long active_possible;   /* and the number without -active-set */
+int active_verifies;
+
+/* -perf: hardware counters of every thread, PERF_N_EVENTS per thread,
+   summed over the Do_Step and the Exchange_Borders calls of Solve since the
+   last Benchmark */
+int perf_flag = 0;
+int *perf_fd;
+int perf_threads;
+long long perf_counts[N_PERF_PHASES][PERF_N_EVENTS];
+double perf_time[N_PERF_PHASES];
+long long perf_mark[PERF_N_EVENTS]; /* counts at the end of the last phase */
+double perf_mark_time;
+double perf_points; /* points updated by the counted iterations */
+
+/* -autotune: loop variant and threads per process of every grid size are
+   the fastest of a timed search, or taken from the tuning cache */
+int autotune_flag = 0;
+char *tuning_cache = "ppoisson2_tuning.txt";
+char *loop_names[] = {"naive", "efficient", "checkerboard"};
+
+/* checkpoint/restart: every checkpoint_every iterations each process writes
+   its phi into one of two slot files in checkpoint_dir, alternately, so a
+   job killed while writing still leaves the previous checkpoint */
+int checkpoint_every = 0;
+char *checkpoint_dir = NULL;
+int restart_flag = 0;
+int n_checkpoints;        /* written in the current Solve */
+int checkpoint_slot;      /* slot of the newest checkpoint */
+double checkpoint_time;   /* seconds spent writing them */
+
+/* -slow-rank: process slow_rank spends slow_time more seconds on every
+   iteration, a noisy neighbour for comparing the synchronous and the
+   asynchronous iteration */
+int slow_rank = -1;
+double slow_time = 0.0;
 
 /* relaxation paramater */
 double omega;
@@ -71,9 +452,45 @@ double *omegas;
 // omegas = malloc(sizeof(double));
 // omegas[0] = 1.95;
 int omega_length = 1;
+int omega_mode = OMEGA_FIXED;
 
-/* error array*/
-double *errors;
+/* state of the omega estimation of -omega auto and chebyshev */
+int omega_adapting;     /* TRUE while the estimate may still change */
+int omega_stable;       /* number of consecutive settled ratios */
+double omega_delta;     /* global_delta of the previous iteration, 0 after a change of omega */
+double omega_ratio;     /* previous ratio of two global_deltas */
+double rho_jacobi2 = 0; /* estimate of the squared spectral radius of Jacobi, 0 if none yet */
+int chebyshev_step;     /* half-sweeps since the last estimate */
+
+/*
+ * Per-iteration telemetry: records of width doubles are appended to the
+ * preallocated chunks of a stream, a full chunk is written to the anonymous
+ * spill file of the stream by a background thread while the next one
+ * fills. The chunks of all streams are flushed in the order they filled.
+ */
+typedef struct Telemetry
+{
+  int width;
+  double *chunk[TELEMETRY_POOL];
+  int full[TELEMETRY_POOL]; /* set while queued for the flush thread */
+  int cur;                  /* chunk being filled */
+  int fill;                 /* records in chunk cur */
+  long n_flushed;           /* records in the spill file or queued for it */
+  FILE *spill;
+} Telemetry;
+
+Telemetry iteration_log; /* wall time, latency and bytes of every iteration */
+Telemetry error_log;     /* global delta of every iteration, on rank 0 */
+Telemetry tile_log;      /* tiles updated by this process in every iteration */
+int telemetry_on = 0;
+pthread_t telemetry_thread;
+pthread_mutex_t telemetry_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t telemetry_cond = PTHREAD_COND_INITIALIZER;
+Telemetry *telemetry_queue[TELEMETRY_STREAMS * TELEMETRY_POOL]; /* full chunks, oldest at telemetry_head */
+int telemetry_queue_chunk[TELEMETRY_STREAMS * TELEMETRY_POOL];
+int telemetry_head = 0;
+int telemetry_queued = 0;
+int telemetry_stop = 0;
 
 /* sweep array */
 int sweep;
@@ -86,31 +503,129 @@ int sweep_length = 1;
 
 /* latency analysis */
 double latency;
-double *latencies;
 double byte;
-double *bytes;
-int latency_length;
 
 /*time v iterations*/
-double* time_by_iteration;
 int timeviter_flag;
-int time_by_iteration_size = 0;
 double iter_time;
 
 
 /* function declarations */
+double *Read_Problem(char *fn, int *n);
+void Read_Input();
+void Read_Batch();
 void Setup_Grid();
+void Reset_Grid();
+void Setup_Batch();
+void Owned_Range(int n, int d, int coord, int *lo, int *hi);
+void Save_Warm_Start();
+void Warm_Start();
+void Build_Spans(int rows, int x_lo, int x_hi, int y_lo, int y_hi,
+                 int n_fixed, int *fixed_x, int *fixed_y, int shift,
+                 int **ptr, int **lo_out, int **hi_out);
+void Setup_Deep_Halo();
+void Alloc_Shared_Phi();
 void Setup_Proc_Grid(int argc, char **argv);
+void Setup_Cart_Grid(MPI_Comm comm);
+void Select_Proc_Grid();
+double Time_Local_Iterations(int n_iter, int *border_bytes);
+void Autotune();
+void Perf_Setup();
+void Perf_Mark();
+void Perf_Phase(int phase);
+void Perf_Report();
 void Get_CLIs(int argc, char **argv);
+void Setup_Ensemble();
+void Run_Config(int j, int i);
+void Run_Ensemble();
+void Ensemble_Results(int j);
 void Setup_MPI_Datatypes();
+void Setup_Checkerboard_Datatypes();
+void Setup_Deep_Halo_Datatypes();
 void Exchange_Borders();
+void Exchange_Borders_Start();
+void Exchange_Borders_Finish();
+void Halo_Engine_Reset();
+void Halo_Engine_Setup();
+void Halo_Pack(int i, char *buf);
+void Halo_Unpack(int i, char *buf);
+void Halo_Exchange();
+void Calibrate_Halo();
+int Step_Colour(int parity);
 double Do_Step(int parity);
+double Do_Step_Region(int parity, int x_lo, int x_hi, int y_lo, int y_hi);
+double Do_Step_Interior(int parity);
+double Do_Step_Frame(int parity);
+double Do_Step_Checkerboard(int parity, int x_lo, int x_hi, int y_lo, int y_hi);
+double Do_Step_Float(int parity, int x_lo, int x_hi, int y_lo, int y_hi);
+void Mixed_Precision_Begin();
+int Mixed_Precision_Done(double global_delta);
+void Mixed_Precision_End();
+void Setup_Halo_Table(char *field, int size, MPI_Datatype *types);
+void Checkerboard_Strip_Type(int x, int y, int dx, int dy, int n, MPI_Datatype *type);
+void Colour_Strip_Type(char *field, int size, int x, int y, int dx, int dy, int n, int c,
+                       void **buf, MPI_Datatype *type);
+void Setup_Colour_Table(char *field, int size);
+void Free_Colour_Table();
+double *Checkerboard_Point(int x, int y);
+void Checkerboard_Split();
+void Checkerboard_Merge();
+double Deep_Halo_Region(int parity, int x_lo, int x_hi, int y_lo, int y_hi);
+void Deep_Halo_Block(int n_iter, double *deltas);
+void Deep_Halo_Swap();
+double Solve_Deep_Halo();
+void Record_Iteration(double iteration_time);
+void Adaptive_Begin();
+double Border_Change();
+void Adaptive_Reduce(double *local_delta, double *global_delta);
+int Adaptive_Decide(int converged, double global_delta);
+void Adaptive_End();
+void Active_Begin();
+void Active_Save_Halo(int i, int j);
+double Active_Halo_Change(int i, int j);
+void Active_Select();
+double Active_Step(int parity);
+int Active_Decide(int converged);
+void Active_End();
+int Record_Errors(double *global_deltas, int first, int n, double *global_delta);
+double **Level_Array(int *dim);
+void Setup_Multigrid();
+void Setup_Level(Level *lv, Level *fine);
+void Level_Select(Level *lv);
+void Level_Exchange(Level *lv, double **a);
+void Level_Smooth(Level *lv, int n_sweeps);
+void Level_Residual(Level *lv);
+void Restrict(int l);
+void Prolong(int l);
+void Gather_Level(int l);
+void Scatter_Level(int l, int add);
+void Vcycle(int l);
+void Full_Multigrid(int l);
+double Solve_Multigrid();
+void Slow_Down();
+void Async_Refresh(MPI_Win win, char *stage, int *send_off, MPI_Aint *put_disp);
+double Solve_Async();
+void Batch_Step(int parity, double *err);
+double Solve_Batch();
+void Clean_Up_Multigrid();
+void Reset_Omega();
+double Next_Omega();
+void Adapt_Omega(double global_delta);
 void Solve();
+void Write_Checkpoint(double global_delta);
+int Read_Checkpoint(double *global_delta);
+void Remove_Checkpoints();
 void Write_Grid();
 void Benchmark();
+void Telemetry_Start();
+void Telemetry_Stop();
+void Telemetry_Append(Telemetry *t, double *record);
+void Telemetry_Reset(Telemetry *t);
+double *Telemetry_Collect(Telemetry *t, long *n);
 void Error_Analysis();
 void Sweep_Analysis();
 void Latency_Analysis();
+void Tile_Analysis();
 void timeVIteration();
 void Clean_Up_Problemdata();
 void Clean_Up_Metadata();
@@ -125,7 +640,7 @@ void start_timer()
 {
   if (!timer_on)
   {
-    MPI_Barrier(MPI_COMM_WORLD);
+    MPI_Barrier(grid_comm);
     ticks = clock();
     wtime = MPI_Wtime();
     timer_on = 1;
@@ -170,10 +685,11 @@ void print_timer()
 
 void generate_fn(char *fn, char *folder, char *type)
 {
-  char fn_template[] = "%s/procg=%ix%i__gs=%ix%i_wl=%3.2f_wh=%3.2f_nomega=%i_swpl=%i_swph=%i_eloop=%i_%s.dat";
+  char fn_template[] = "%s/procg=%ix%i__gs=%ix%i_wl=%3.2f_wh=%3.2f_nomega=%i_swpl=%i_swph=%i_eloop=%i_nt=%i_dh=%i_solver=%s_prec=%s_halo=%s_batch=%i_%s.dat";
   sprintf(fn, fn_template, folder, P_grid[X_DIR], P_grid[Y_DIR], gridsize[X_DIR],
           gridsize[Y_DIR], omegas[0], omegas[omega_length - 1], omega_length,
-          sweeps[0], sweeps[sweep_length - 1], efficient_loop_flag, type);
+          sweeps[0], sweeps[sweep_length - 1], efficient_loop_flag, n_threads,
+          deep_halo_flag, solver_names[solver], precision_names[precision], halo_names[halo_engine], batch_size, type);
 }
 
 void Debug(char *mesg, int terminate)
@@ -184,35 +700,111 @@ void Debug(char *mesg, int terminate)
     exit(1);
 }
 
-void Setup_Grid()
+/*
+ * Rank 0 reads the problem file fn once, all processes receive it as one
+ * buffer of n doubles: precision goal, max iterations, number of sources
+ * and the sources. The grid size of the file is not used, it comes from
+ * -grid or -grids.
+ */
+double *Read_Problem(char *fn, int *n_out)
 {
-  int x, y, s;
-  double source_x, source_y, source_val;
-  int upper_offset[2];
+  int n = 3, size = 3, file_size[2], file_max_iter;
+  double *buf;
+  double file_precision_goal, source_x, source_y, source_val;
+  char mesg[300];
   FILE *f;
 
-  // Debug("Setup_Subgrid", 0);
+  if ((buf = malloc(size * sizeof(double))) == NULL)
+    Debug("Read_Problem : malloc(buf) failed", 1);
 
   if (proc_rank == 0)
   {
-    f = fopen("input.dat", "r");
+    f = fopen(fn, "r");
     if (f == NULL)
-      Debug("Error opening input.dat", 1);
-    fscanf(f, "nx: %i\n", &gridsize[X_DIR]);
-    fscanf(f, "ny: %i\n", &gridsize[Y_DIR]);
-    fscanf(f, "precision goal: %lf\n", &precision_goal);
-    fscanf(f, "max iterations: %i\n", &max_iter);
+    {
+      sprintf(mesg, "Error opening %.250s", fn);
+      Debug(mesg, 1);
+    }
+    fscanf(f, "nx: %i\n", &file_size[X_DIR]);
+    fscanf(f, "ny: %i\n", &file_size[Y_DIR]);
+    fscanf(f, "precision goal: %lf\n", &file_precision_goal);
+    fscanf(f, "max iterations: %i\n", &file_max_iter);
+    buf[0] = file_precision_goal;
+    buf[1] = file_max_iter;
+    while (fscanf(f, "source: %lf %lf %lf\n", &source_x, &source_y, &source_val) == 3)
+    {
+      if (n + 3 > size)
+      {
+        size *= 2;
+        if ((buf = realloc(buf, size * sizeof(double))) == NULL)
+          Debug("Read_Problem : realloc(buf) failed", 1);
+      }
+      buf[n++] = source_x;
+      buf[n++] = source_y;
+      buf[n++] = source_val;
+    }
+    buf[2] = (n - 3) / 3;
+    fclose(f);
   }
 
+  MPI_Bcast(&n, 1, MPI_INT, 0, grid_comm);
+  if (proc_rank != 0 && (buf = realloc(buf, n * sizeof(double))) == NULL)
+    Debug("Read_Problem : realloc(buf) failed", 1);
+  MPI_Bcast(buf, n, MPI_DOUBLE, 0, grid_comm);
+
+  *n_out = n;
+  return buf;
+}
+
+void Read_Input()
+{
+  int n;
+  double *buf = Read_Problem("input.dat", &n);
+
+  precision_goal = buf[0];
+  max_iter = buf[1];
+  n_input_src = buf[2];
+  if ((input_src = malloc((n - 3) * sizeof(double) + 1)) == NULL)
+    Debug("Read_Input : malloc(input_src) failed", 1);
+  memcpy(input_src, buf + 3, (n - 3) * sizeof(double));
+  free(buf);
+
+  if (batch_size > 0)
+    Read_Batch();
+}
+
+/* the problems of -batch, each with its own precision goal and max iterations */
+void Read_Batch()
+{
+  int b, n;
+
+  batch_stride = (batch_size + BATCH_LANES - 1) / BATCH_LANES * BATCH_LANES;
+  if ((batch_problem = malloc(batch_size * sizeof(double *))) == NULL)
+    Debug("Read_Batch : malloc(batch_problem) failed", 1);
+  if ((batch_active = calloc(batch_stride, sizeof(int))) == NULL)
+    Debug("Read_Batch : calloc(batch_active) failed", 1);
+  if ((batch_group_active = malloc(batch_stride / BATCH_LANES * sizeof(int))) == NULL)
+    Debug("Read_Batch : malloc(batch_group_active) failed", 1);
+  if ((batch_iters = malloc(batch_size * sizeof(int))) == NULL)
+    Debug("Read_Batch : malloc(batch_iters) failed", 1);
+  if ((batch_error = malloc(batch_size * sizeof(double))) == NULL)
+    Debug("Read_Batch : malloc(batch_error) failed", 1);
+  for (b = 0; b < batch_size; b++)
+    batch_problem[b] = Read_Problem(batch_files[b], &n);
+}
+
+void Setup_Grid()
+{
+  int x, y, s, c;
+  double source_x, source_y, source_val;
+  int upper_offset[2];
+
+  // Debug("Setup_Subgrid", 0);
+
   gridsize[X_DIR] = gridsizes[grid_size_idx];
   gridsize[Y_DIR] = gridsizes[grid_size_idx];
-
-  // broadcast gridsize, precision_goal and max_iter to all processes
-  MPI_Barrier(grid_comm);
-  MPI_Bcast(&gridsize, 2, MPI_INT, 0, grid_comm);
-  MPI_Bcast(&precision_goal, 1, MPI_DOUBLE, 0, grid_comm);
-  MPI_Bcast(&max_iter, 1, MPI_INT, 0, grid_comm);
-  MPI_Barrier(grid_comm);
+  setup_gridsize = gridsize[X_DIR];
+  setup_sweep = sweep;
 
   /* Calculate top  left  corner  coordinates  of  local  grid  */
   offset[X_DIR] = gridsize[X_DIR] * proc_coord[X_DIR] / P_grid[X_DIR];
@@ -231,72 +823,491 @@ void Setup_Grid()
   /* allocate memory */
   if ((phi = malloc(dim[X_DIR] * sizeof(*phi))) == NULL)
     Debug("Setup_Subgrid : malloc(phi) failed", 1);
-  if ((source = malloc(dim[X_DIR] * sizeof(*source))) == NULL)
-    Debug("Setup_Subgrid : malloc(source) failed", 1);
-  if ((phi[0] = malloc(dim[Y_DIR] * dim[X_DIR] * sizeof(**phi))) == NULL)
+  if (halo_engine == HALO_SHARED || halo_auto_flag)
+  {
+    Alloc_Shared_Phi();
+  }
+  else if ((phi[0] = malloc(dim[Y_DIR] * dim[X_DIR] * sizeof(**phi))) == NULL)
     Debug("Setup_Subgrid : malloc(*phi) failed", 1);
-  if ((source[0] = malloc(dim[Y_DIR] * dim[X_DIR] * sizeof(**source))) == NULL)
-    Debug("Setup_Subgrid : malloc(*source) failed", 1);
   for (x = 1; x < dim[X_DIR]; x++)
-  {
     phi[x] = phi[0] + x * dim[Y_DIR];
-    source[x] = source[0] + x * dim[Y_DIR];
+
+  /* set all values to '0', each thread touches the rows it updates in Do_Step */
+#pragma omp parallel for private(y) schedule(static)
+  for (x = 0; x < dim[X_DIR]; x++)
+    for (y = 0; y < dim[Y_DIR]; y++)
+      phi[x][y] = 0.0;
+
+  if (efficient_loop_flag == CHECKERBOARD_LOOP)
+  {
+    /* (dim[Y_DIR] + 1) / 2 points of each colour per row, rounded up to 8 doubles */
+    cb_stride = (((dim[Y_DIR] + 1) / 2 + 7) / 8) * 8;
+    for (c = 0; c < 2; c++)
+      if ((cb_phi[c] = aligned_alloc(64, dim[X_DIR] * cb_stride * sizeof(double))) == NULL)
+        Debug("Setup_Subgrid : aligned_alloc(cb_phi) failed", 1);
   }
 
-  /* set all values to '0' */
+  /* put sources in field */
+  n_src = 0;
+  src_x = NULL;
+  src_y = NULL;
+  src_val = NULL;
+  for (s = 0; s < n_input_src; s++)
+  {
+    source_x = input_src[3 * s];
+    source_y = input_src[3 * s + 1];
+    source_val = input_src[3 * s + 2];
+    x = source_x * gridsize[X_DIR];
+    y = source_y * gridsize[Y_DIR];
+    x += 1;
+    y += 1;
+    x = x - offset[X_DIR];
+    y = y - offset[Y_DIR];
+    if (x > 0 && x < dim[X_DIR] - 1 && y > 0 && y < dim[Y_DIR] - 1)
+    { /* indices in domain of this process */
+      phi[x][y] = source_val;
+    }
+    /* the deep halo also needs the sources of the neighbours */
+    n_src++;
+    if ((src_x = realloc(src_x, n_src * sizeof(int))) == NULL)
+      Debug("Setup_Subgrid : realloc(src_x) failed", 1);
+    if ((src_y = realloc(src_y, n_src * sizeof(int))) == NULL)
+      Debug("Setup_Subgrid : realloc(src_y) failed", 1);
+    if ((src_val = realloc(src_val, n_src * sizeof(double))) == NULL)
+      Debug("Setup_Subgrid : realloc(src_val) failed", 1);
+    src_x[n_src - 1] = x;
+    src_y[n_src - 1] = y;
+    src_val[n_src - 1] = source_val;
+  }
+
+  /* initial state of every run on this grid */
+  if ((phi_init = malloc(dim[X_DIR] * dim[Y_DIR] * sizeof(double))) == NULL)
+    Debug("Setup_Subgrid : malloc(phi_init) failed", 1);
+  memcpy(phi_init, phi[0], dim[X_DIR] * dim[Y_DIR] * sizeof(double));
+
+  Build_Spans(dim[X_DIR], 1, dim[X_DIR] - 1, 1, dim[Y_DIR] - 1, n_src, src_x, src_y, 0,
+              &span_ptr, &span_lo, &span_hi);
+
+  if (deep_halo_flag)
+    Setup_Deep_Halo();
+
+  if (solver == SOLVER_VCYCLE || solver == SOLVER_FMG)
+    Setup_Multigrid();
+
+  if (batch_size > 0)
+    Setup_Batch();
+}
+
+/* start another run on the grid of the last Setup_Grid */
+void Reset_Grid()
+{
+  int x, y;
+
+#pragma omp parallel for private(y) schedule(static)
   for (x = 0; x < dim[X_DIR]; x++)
     for (y = 0; y < dim[Y_DIR]; y++)
+      phi[x][y] = phi_init[x * dim[Y_DIR] + y];
+
+  /* Solve_Deep_Halo only copies the one-cell halo of phi */
+  if (deep_halo_flag)
+    memset(dh_phi[0], 0, dh_dim[X_DIR] * dh_dim[Y_DIR] * sizeof(double));
+}
+
+/*
+ * Interleaved initial state of the -batch problems with their sources, and
+ * the spans between the sources of all problems. A source of only some of
+ * the problems is an ordinary point of the others, Batch_Step updates it for
+ * them from batch_extra.
+ */
+void Setup_Batch()
+{
+  int b, s, i, j, x, y, n = 0, n_y = dim[Y_DIR] * batch_stride;
+  int *fixed_x, *fixed_y, *fixed_b, *is_source;
+  double *problem;
+
+  if ((bphi = malloc(dim[X_DIR] * sizeof(*bphi))) == NULL)
+    Debug("Setup_Batch : malloc(bphi) failed", 1);
+  if ((bphi[0] = malloc(dim[X_DIR] * n_y * sizeof(**bphi))) == NULL)
+    Debug("Setup_Batch : malloc(*bphi) failed", 1);
+  for (x = 1; x < dim[X_DIR]; x++)
+    bphi[x] = bphi[0] + x * n_y;
+  if ((bphi_init = calloc(dim[X_DIR] * n_y, sizeof(double))) == NULL)
+    Debug("Setup_Batch : calloc(bphi_init) failed", 1);
+
+  for (b = 0; b < batch_size; b++)
+    n += batch_problem[b][2];
+  if ((fixed_x = malloc((n + 1) * sizeof(int))) == NULL ||
+      (fixed_y = malloc((n + 1) * sizeof(int))) == NULL ||
+      (fixed_b = malloc((n + 1) * sizeof(int))) == NULL)
+    Debug("Setup_Batch : malloc(fixed) failed", 1);
+
+  /* sources in local coordinates, as Setup_Grid puts them */
+  n = 0;
+  for (b = 0; b < batch_size; b++)
+  {
+    problem = batch_problem[b];
+    for (s = 0; s < problem[2]; s++)
     {
-      phi[x][y] = 0.0;
-      source[x][y] = 0;
+      x = problem[3 + 3 * s] * gridsize[X_DIR];
+      y = problem[3 + 3 * s + 1] * gridsize[Y_DIR];
+      x += 1 - offset[X_DIR];
+      y += 1 - offset[Y_DIR];
+      if (x > 0 && x < dim[X_DIR] - 1 && y > 0 && y < dim[Y_DIR] - 1)
+        bphi_init[(x * dim[Y_DIR] + y) * batch_stride + b] = problem[3 + 3 * s + 2];
+      fixed_x[n] = x;
+      fixed_y[n] = y;
+      fixed_b[n] = b;
+      n++;
     }
+  }
 
-  /* put sources in field */
-  MPI_Barrier(grid_comm);
-  do
+  Build_Spans(dim[X_DIR], 1, dim[X_DIR] - 1, 1, dim[Y_DIR] - 1, n, fixed_x, fixed_y, 0,
+              &bspan_ptr, &bspan_lo, &bspan_hi);
+
+  if ((batch_extra = malloc((3 * n * batch_size + 1) * sizeof(int))) == NULL)
+    Debug("Setup_Batch : malloc(batch_extra) failed", 1);
+  if ((is_source = malloc(batch_size * sizeof(int))) == NULL)
+    Debug("Setup_Batch : malloc(is_source) failed", 1);
+  n_batch_extra = 0;
+  for (i = 0; i < n; i++)
   {
-    if (proc_rank == 0)
+    x = fixed_x[i];
+    y = fixed_y[i];
+    if (x <= 0 || x >= dim[X_DIR] - 1 || y <= 0 || y >= dim[Y_DIR] - 1)
+      continue;
+    /* each point once, at its first source */
+    for (j = 0; j < i; j++)
+      if (fixed_x[j] == x && fixed_y[j] == y)
+        break;
+    if (j < i)
+      continue;
+    for (b = 0; b < batch_size; b++)
+      is_source[b] = 0;
+    for (j = i; j < n; j++)
+      if (fixed_x[j] == x && fixed_y[j] == y)
+        is_source[fixed_b[j]] = 1;
+    for (b = 0; b < batch_size; b++)
+      if (!is_source[b])
+      {
+        batch_extra[3 * n_batch_extra] = x;
+        batch_extra[3 * n_batch_extra + 1] = y;
+        batch_extra[3 * n_batch_extra + 2] = b;
+        n_batch_extra++;
+      }
+  }
+
+  free(is_source);
+  free(fixed_x);
+  free(fixed_y);
+  free(fixed_b);
+}
+
+/* global indices lo ... hi of the interior a process at coord owns in
+   dimension d of a grid of size n, as Setup_Grid divides it */
+void Owned_Range(int n, int d, int coord, int *lo, int *hi)
+{
+  *lo = n * coord / P_grid[d] + 1;
+  *hi = n * (coord + 1) / P_grid[d];
+}
+
+/* keep phi of the run that just finished for Warm_Start, or phi_init when
+   only the deep halo of the same grid size is set up again */
+void Save_Warm_Start()
+{
+  free(warm_phi);
+  if ((warm_phi = malloc(dim[X_DIR] * dim[Y_DIR] * sizeof(double))) == NULL)
+    Debug("Save_Warm_Start : malloc(warm_phi) failed", 1);
+  memcpy(warm_phi, gridsizes[grid_size_idx] != setup_gridsize ? phi[0] : phi_init,
+         dim[X_DIR] * dim[Y_DIR] * sizeof(double));
+  warm_gridsize = setup_gridsize;
+}
+
+/*
+ * Replace the zero initial phi of the grid Setup_Grid just built by the
+ * bilinear interpolation of warm_phi. Global point g of the new grid lies at
+ * g * (n0 + 1) / (n1 + 1) on the old one, whose boundary 0 and n0 + 1 is 0.
+ * Both decompositions follow from Owned_Range, so every process knows which
+ * block of the old points each other process needs, including the halo
+ * rows, and one MPI_Alltoallv moves them. Sources are set again afterwards.
+ */
+void Warm_Start()
+{
+  int n0 = warm_gridsize, n1 = gridsize[X_DIR];
+  int d, q, x, y, gx, gy, i0, j0, pos;
+  int coord[2], lo[2], hi[2], need_lo[2], need_hi[2], old_dim[2];
+  int r_lo[2], r_hi[2], o_lo[2], o_hi[2], len[2];
+  int *send_counts, *send_displs, *recv_counts, *recv_displs;
+  double *send_buf, *recv_buf, *old, wx, wy;
+
+  if ((send_counts = malloc(4 * P * sizeof(int))) == NULL)
+    Debug("Warm_Start : malloc(send_counts) failed", 1);
+  send_displs = send_counts + P;
+  recv_counts = send_counts + 2 * P;
+  recv_displs = send_counts + 3 * P;
+
+  /* old points of the new local grid, halos included */
+  for (d = X_DIR; d <= Y_DIR; d++)
+  {
+    Owned_Range(n0, d, proc_coord[d], &lo[d], &hi[d]);
+    old_dim[d] = hi[d] - lo[d] + 3;
+    need_lo[d] = (long)offset[d] * (n0 + 1) / (n1 + 1);
+    need_hi[d] = (long)(offset[d] + dim[d] - 1) * (n0 + 1) / (n1 + 1) + 1;
+    need_hi[d] = min(need_hi[d], n0 + 1);
+  }
+
+  /* each block is sent x major, in the order of the ranks */
+  for (q = 0; q < P; q++)
+  {
+    MPI_Cart_coords(grid_comm, q, 2, coord);
+    send_counts[q] = recv_counts[q] = 1;
+    for (d = X_DIR; d <= Y_DIR; d++)
     {
-      s = fscanf(f, "source: %lf %lf %lf\n", &source_x, &source_y, &source_val);
+      /* the points of mine process q needs */
+      r_lo[d] = (long)(n1 * coord[d] / P_grid[d]) * (n0 + 1) / (n1 + 1);
+      r_hi[d] = (long)(n1 * (coord[d] + 1) / P_grid[d] + 1) * (n0 + 1) / (n1 + 1) + 1;
+      len[d] = min(r_hi[d], hi[d]) - max(r_lo[d], lo[d]) + 1;
+      send_counts[q] *= len[d] > 0 ? len[d] : 0;
+      /* the points of process q I need */
+      Owned_Range(n0, d, coord[d], &o_lo[d], &o_hi[d]);
+      len[d] = min(need_hi[d], o_hi[d]) - max(need_lo[d], o_lo[d]) + 1;
+      recv_counts[q] *= len[d] > 0 ? len[d] : 0;
     }
-    MPI_Bcast(&s, 1, MPI_INT, 0, grid_comm);
-    if (s == 3)
+    send_displs[q] = q == 0 ? 0 : send_displs[q - 1] + send_counts[q - 1];
+    recv_displs[q] = q == 0 ? 0 : recv_displs[q - 1] + recv_counts[q - 1];
+  }
+
+  if ((send_buf = malloc((send_displs[P - 1] + send_counts[P - 1] + 1) * sizeof(double))) == NULL)
+    Debug("Warm_Start : malloc(send_buf) failed", 1);
+  if ((recv_buf = malloc((recv_displs[P - 1] + recv_counts[P - 1] + 1) * sizeof(double))) == NULL)
+    Debug("Warm_Start : malloc(recv_buf) failed", 1);
+
+  pos = 0;
+  for (q = 0; q < P; q++)
+  {
+    if (send_counts[q] == 0)
+      continue;
+    MPI_Cart_coords(grid_comm, q, 2, coord);
+    for (d = X_DIR; d <= Y_DIR; d++)
     {
-      MPI_Bcast(&source_x, 1, MPI_DOUBLE, 0, grid_comm);
-      MPI_Bcast(&source_y, 1, MPI_DOUBLE, 0, grid_comm);
-      MPI_Bcast(&source_val, 1, MPI_DOUBLE, 0, grid_comm);
-      x = source_x * gridsize[X_DIR];
-      y = source_y * gridsize[Y_DIR];
-      x += 1;
-      y += 1;
-      x = x - offset[X_DIR];
-      y = y - offset[Y_DIR];
-      if (x > 0 && x < dim[X_DIR] - 1 && y > 0 && y < dim[Y_DIR] - 1)
-      { /* indices in domain of this process */
-        phi[x][y] = source_val;
-        source[x][y] = 1;
+      r_lo[d] = (long)(n1 * coord[d] / P_grid[d]) * (n0 + 1) / (n1 + 1);
+      r_hi[d] = (long)(n1 * (coord[d] + 1) / P_grid[d] + 1) * (n0 + 1) / (n1 + 1) + 1;
+      r_lo[d] = max(r_lo[d], lo[d]);
+      r_hi[d] = min(r_hi[d], hi[d]);
+    }
+    for (gx = r_lo[X_DIR]; gx <= r_hi[X_DIR]; gx++)
+      for (gy = r_lo[Y_DIR]; gy <= r_hi[Y_DIR]; gy++)
+        send_buf[pos++] = warm_phi[(gx - lo[X_DIR] + 1) * old_dim[Y_DIR] + gy - lo[Y_DIR] + 1];
+  }
+
+  MPI_Alltoallv(send_buf, send_counts, send_displs, MPI_DOUBLE, recv_buf, recv_counts, recv_displs,
+                MPI_DOUBLE, grid_comm);
+
+  /* the old points around the new local grid, the old boundary stays 0 */
+  len[X_DIR] = need_hi[X_DIR] - need_lo[X_DIR] + 1;
+  len[Y_DIR] = need_hi[Y_DIR] - need_lo[Y_DIR] + 1;
+  if ((old = calloc(len[X_DIR] * len[Y_DIR], sizeof(double))) == NULL)
+    Debug("Warm_Start : calloc(old) failed", 1);
+  pos = 0;
+  for (q = 0; q < P; q++)
+  {
+    if (recv_counts[q] == 0)
+      continue;
+    MPI_Cart_coords(grid_comm, q, 2, coord);
+    for (d = X_DIR; d <= Y_DIR; d++)
+    {
+      Owned_Range(n0, d, coord[d], &o_lo[d], &o_hi[d]);
+      o_lo[d] = max(o_lo[d], need_lo[d]);
+      o_hi[d] = min(o_hi[d], need_hi[d]);
+    }
+    for (gx = o_lo[X_DIR]; gx <= o_hi[X_DIR]; gx++)
+      for (gy = o_lo[Y_DIR]; gy <= o_hi[Y_DIR]; gy++)
+        old[(gx - need_lo[X_DIR]) * len[Y_DIR] + gy - need_lo[Y_DIR]] = recv_buf[pos++];
+  }
+
+  /* points of the new boundary keep their 0 */
+  for (x = 0; x < dim[X_DIR]; x++)
+  {
+    gx = offset[X_DIR] + x;
+    if (gx < 1 || gx > n1)
+      continue;
+    i0 = (long)gx * (n0 + 1) / (n1 + 1);
+    wx = (double)((long)gx * (n0 + 1) % (n1 + 1)) / (n1 + 1);
+    i0 -= need_lo[X_DIR];
+    for (y = 0; y < dim[Y_DIR]; y++)
+    {
+      gy = offset[Y_DIR] + y;
+      if (gy < 1 || gy > n1)
+        continue;
+      j0 = (long)gy * (n0 + 1) / (n1 + 1);
+      wy = (double)((long)gy * (n0 + 1) % (n1 + 1)) / (n1 + 1);
+      j0 -= need_lo[Y_DIR];
+      phi[x][y] = (1.0 - wx) * ((1.0 - wy) * old[i0 * len[Y_DIR] + j0] + wy * old[i0 * len[Y_DIR] + j0 + 1]) +
+                  wx * ((1.0 - wy) * old[(i0 + 1) * len[Y_DIR] + j0] + wy * old[(i0 + 1) * len[Y_DIR] + j0 + 1]);
+    }
+  }
+
+  /* sources, also those in the halos */
+  for (q = 0; q < n_src; q++)
+    if (src_x[q] >= 0 && src_x[q] < dim[X_DIR] && src_y[q] >= 0 && src_y[q] < dim[Y_DIR])
+      phi[src_x[q]][src_y[q]] = src_val[q];
+
+  memcpy(phi_init, phi[0], dim[X_DIR] * dim[Y_DIR] * sizeof(double));
+
+  if (proc_rank == 0 && n0 != n1)
+    printf("(%i) Starting grid size %i from the solution on grid size %i\n", proc_rank, n1, n0);
+
+  free(old);
+  free(send_buf);
+  free(recv_buf);
+  free(send_counts);
+  free(warm_phi);
+  warm_phi = NULL;
+}
+
+/*
+ * Split the rows x_lo <= x < x_hi of an array with the given number of rows
+ * into the spans of [y_lo, y_hi) between the fixed points, so Do_Step can
+ * update each span without testing for sources. Fixed points are shifted by
+ * shift from local coordinates to the coordinates of the array.
+ */
+void Build_Spans(int rows, int x_lo, int x_hi, int y_lo, int y_hi,
+                 int n_fixed, int *fixed_x, int *fixed_y, int shift,
+                 int **ptr, int **lo_out, int **hi_out)
+{
+  int x, i, lo, hi, n_spans;
+  int *row_ptr, *row_lo, *row_hi;
+
+  /* every span but the last one of a row ends at a distinct fixed point */
+  n_spans = rows + n_fixed;
+  if ((row_ptr = malloc((rows + 1) * sizeof(int))) == NULL)
+    Debug("Build_Spans : malloc(span_ptr) failed", 1);
+  if ((row_lo = malloc(n_spans * sizeof(int))) == NULL)
+    Debug("Build_Spans : malloc(span_lo) failed", 1);
+  if ((row_hi = malloc(n_spans * sizeof(int))) == NULL)
+    Debug("Build_Spans : malloc(span_hi) failed", 1);
+
+  n_spans = 0;
+  row_ptr[0] = 0;
+  for (x = 0; x < rows; x++)
+  {
+    lo = y_lo;
+    while (x >= x_lo && x < x_hi)
+    {
+      /* the span ends at the first source at or after lo */
+      hi = y_hi;
+      for (i = 0; i < n_fixed; i++)
+        if (fixed_x[i] + shift == x && fixed_y[i] + shift >= lo && fixed_y[i] + shift < hi)
+          hi = fixed_y[i] + shift;
+      if (hi > lo)
+      {
+        row_lo[n_spans] = lo;
+        row_hi[n_spans] = hi;
+        n_spans++;
       }
+      if (hi == y_hi)
+        break;
+      lo = hi + 1;
     }
-  } while (s == 3);
-  MPI_Barrier(grid_comm);
+    row_ptr[x + 1] = n_spans;
+  }
 
-  if (proc_rank == 0)
+  *ptr = row_ptr;
+  *lo_out = row_lo;
+  *hi_out = row_hi;
+}
+
+/*
+ * Allocate phi[0] in a window shared by the processes of node_comm, so the
+ * shared backend can copy the borders of node-local neighbours straight out
+ * of their phi. Each process keeps its own part (noncontiguous), which it
+ * touches first in Setup_Grid.
+ */
+void Alloc_Shared_Phi()
+{
+  MPI_Info info;
+
+  MPI_Info_create(&info);
+  MPI_Info_set(info, "alloc_shared_noncontig", "true");
+  phi_win_size = dim[Y_DIR] * dim[X_DIR] * sizeof(**phi);
+  MPI_Win_allocate_shared(phi_win_size, sizeof(**phi), info, node_comm, &phi[0], &phi_win);
+  MPI_Info_free(&info);
+  phi_win_base = (char *)phi[0];
+
+  /* one passive epoch for the whole run, MPI_Win_sync orders the accesses */
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, phi_win);
+  phi_shared = 1;
+}
+
+/*
+ * Allocate the deep halo copy of phi. Its spans only cover the points of the
+ * global grid, so the redundant updates stop at the boundary of the domain.
+ */
+void Setup_Deep_Halo()
+{
+  int x, y, d, n, min_n;
+  int lo[2], hi[2];
+
+  halo_width = 2 * sweep;
+  n = min(dim[X_DIR], dim[Y_DIR]) - 2;
+  MPI_Allreduce(&n, &min_n, 1, MPI_INT, MPI_MIN, grid_comm);
+  if (min_n < halo_width)
+    Debug("ERROR Local grid smaller than the deep halo, use fewer sweeps or processes", 1);
+
+  for (d = X_DIR; d <= Y_DIR; d++)
   {
-    fclose(f);
+    dh_dim[d] = dim[d] - 2 + 2 * halo_width;
+    /* shifting by an even number keeps the colour of every point */
+    dh_offset[d] = offset[d] - (halo_width - 1) + 2 * halo_width;
+    /* global indices 1 ... gridsize */
+    lo[d] = max(1, halo_width - offset[d]);
+    hi[d] = min(dh_dim[d] - 1, gridsize[d] - offset[d] + halo_width);
   }
+
+  if ((dh_phi = malloc(dh_dim[X_DIR] * sizeof(*dh_phi))) == NULL)
+    Debug("Setup_Deep_Halo : malloc(dh_phi) failed", 1);
+  if ((dh_phi[0] = malloc(dh_dim[X_DIR] * dh_dim[Y_DIR] * sizeof(**dh_phi))) == NULL)
+    Debug("Setup_Deep_Halo : malloc(*dh_phi) failed", 1);
+  for (x = 1; x < dh_dim[X_DIR]; x++)
+    dh_phi[x] = dh_phi[0] + x * dh_dim[Y_DIR];
+
+#pragma omp parallel for private(y) schedule(static)
+  for (x = 0; x < dh_dim[X_DIR]; x++)
+    for (y = 0; y < dh_dim[Y_DIR]; y++)
+      dh_phi[x][y] = 0.0;
+
+  Build_Spans(dh_dim[X_DIR], lo[X_DIR], hi[X_DIR], lo[Y_DIR], hi[Y_DIR],
+              n_src, src_x, src_y, halo_width - 1, &dh_span_ptr, &dh_span_lo, &dh_span_hi);
 }
 
 void Setup_Proc_Grid(int argc, char **argv)
 {
-  int wrap_around[2];
-  int reorder;
+  int world_size, world_rank, l;
+  MPI_Comm group_comm;
   // Debug("My_MPI_Init", 0);
 
   /* Retrieve the number of processes */
-  MPI_Comm_size(MPI_COMM_WORLD, &P); /* find out how many processes there are        */
+  MPI_Comm_size(MPI_COMM_WORLD, &world_size); /* find out how many processes there are        */
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+
+  /* -ensemble decides the size of the process grid, so it is read here */
+  for (l = 3; l < argc - 1; l++)
+    if (strcmp(argv[l], "-ensemble") == 0)
+      n_groups = atoi(argv[l + 1]);
+  if (n_groups < 1 || world_size % n_groups != 0)
+    Debug("ERROR Number of processes is not a multiple of the ensemble size", 1);
+  P = world_size / n_groups;
+  group = world_rank / P;
+  MPI_Comm_split(MPI_COMM_WORLD, group, world_rank, &group_comm);
 
   /* Calculate the number of processes per column and per row for the grid */
-  if (argc > 2)
+  if (argc > 2 && strcmp(argv[1], "auto") == 0)
+  {
+    /* a P x 1 grid until Select_Proc_Grid has chosen one */
+    proc_grid_auto = 1;
+    P_grid[X_DIR] = P;
+    P_grid[Y_DIR] = 1;
+  }
+  else if (argc > 2)
   {
     P_grid[X_DIR] = atoi(argv[1]);
     P_grid[Y_DIR] = atoi(argv[2]);
@@ -308,6 +1319,16 @@ void Setup_Proc_Grid(int argc, char **argv)
     Debug("ERROR Wrong parameter input", 1);
   }
 
+  Setup_Cart_Grid(group_comm);
+  MPI_Comm_free(&group_comm);
+}
+
+/* build grid_comm as a P_grid process grid over the processes of comm */
+void Setup_Cart_Grid(MPI_Comm comm)
+{
+  int wrap_around[2];
+  int reorder;
+
   /* Create process topology (2D grid) */
   wrap_around[X_DIR] = 0;
   wrap_around[Y_DIR] = 0; /*  do  not  connect  first  and last process        */
@@ -315,11 +1336,13 @@ void Setup_Proc_Grid(int argc, char **argv)
   reorder = 1; /*  reorder process ranks        */
 
   /* Creates a new communicator grid_comm  */
-  MPI_Cart_create(MPI_COMM_WORLD, 2, P_grid, wrap_around, reorder, &grid_comm);
+  MPI_Cart_create(comm, 2, P_grid, wrap_around, reorder, &grid_comm);
 
   /* Retrieve new rank and cartesian coordinates of this process */
   MPI_Comm_rank(grid_comm, &proc_rank);                 /*  Rank  of  process  in  new  communicator        */
   MPI_Cart_coords(grid_comm, proc_rank, 2, proc_coord); /* Coordinates of process in new communicator */
+  MPI_Comm_split(MPI_COMM_WORLD, proc_rank, group, &ensemble_comm);
+  node_comm = MPI_getNodeComm(grid_comm);
 
   printf("(%i) (x,y)=(%i,%i)\n", proc_rank, proc_coord[X_DIR], proc_coord[Y_DIR]);
 
@@ -334,50 +1357,324 @@ void Setup_Proc_Grid(int argc, char **argv)
            proc_right, proc_bottom, proc_left);
 }
 
-void Get_CLIs(int argc, char **argv)
+/*
+ * Seconds per iteration of the SOR sweep of the current loop variant on the
+ * subgrid Setup_Grid gives this process for gridsizes[grid_size_idx],
+ * measured over n_iter iterations on a grid set up only for this. If
+ * border_bytes is not NULL it receives the size of the four borders.
+ */
+double Time_Local_Iterations(int n_iter, int *border_bytes)
 {
-  int l, i;
-  l = 0;
-  double omega_start, omega_end, omega_step;
-  int grid_start, grid_end, grid_step;
-  int sweep_start, sweep_end, sweep_step;
+  int i, r;
+  int saved_deep_halo = deep_halo_flag, saved_solver = solver, saved_halo_auto = halo_auto_flag;
+  double t;
 
-  // default values (in case no CLI args are specified)
-  gridsizes = malloc(sizeof(int));
-  gridsizes[0] = 100;
-  grid_length = 1;
-  omegas = malloc(sizeof(double));
-  omegas[0] = 1.95;
-  omega_length = 1;
-  sweeps = malloc(sizeof(int));
-  sweeps[0] = 1;
-  sweep_length = 1;
+  /* only the SOR sweep and the one-cell halo are timed */
+  deep_halo_flag = 0;
+  solver = SOLVER_SOR;
+  halo_auto_flag = 0;
 
-  if (argc > 3)
+  Setup_Grid();
+  Setup_MPI_Datatypes();
+  if (efficient_loop_flag == CHECKERBOARD_LOOP)
+    Checkerboard_Split();
+
+  MPI_Barrier(grid_comm);
+  t = MPI_Wtime();
+  for (r = 0; r < n_iter; r++)
   {
-    while (l < argc)
+    Do_Step(0);
+    Do_Step(1);
+  }
+  t = (MPI_Wtime() - t) / n_iter;
+
+  if (border_bytes != NULL)
+    for (i = 0; i < 4; i++)
+      MPI_Type_size(halo_send_type[i], &border_bytes[i]);
+  Clean_Up_Problemdata();
+
+  deep_halo_flag = saved_deep_halo;
+  solver = saved_solver;
+  halo_auto_flag = saved_halo_auto;
+  return t;
+}
+
+/*
+ * Pick efficient_loop_flag and the number of threads for the grid size
+ * gridsizes[grid_size_idx]. The cache is keyed by the CPU model, the local
+ * dims of rank 0, the number of processes, the available threads and the
+ * variants the other options allow; on a
+ * miss every loop variant the other options allow is timed with 1, 2, 4,
+ * ... n_threads threads on the real subgrids and the fastest of the
+ * slowest process is appended to the cache.
+ */
+void Autotune()
+{
+  char key[400], line[600], cpu[256] = "unknown", *tab;
+  int loop, best_loop = efficient_loop_flag, threads, best_threads = n_threads;
+  int tuned[3] = {0, 0, 0}; /* found in the cache, loop, threads */
+  int allowed = 0;          /* bit loop is set for every variant the other options run with */
+  double t, best_t = 0.0;
+  FILE *f;
+
+  for (loop = NAIVE_LOOP; loop <= CHECKERBOARD_LOOP; loop++)
+    if ((loop == EFFICIENT_LOOP || (precision == PREC_DOUBLE && solver == SOLVER_SOR && batch_size == 0 &&
+                                  active_set_factor == 0.0)) &&
+        !(loop == CHECKERBOARD_LOOP && (deep_halo_flag || adaptive_fraction > 0.0)))
+      allowed |= 1 << loop;
+
+  if (proc_rank == 0)
+  {
+    /* the first "model name" of /proc/cpuinfo */
+    if ((f = fopen("/proc/cpuinfo", "r")) != NULL)
     {
-      if (strcmp(argv[l], "-omega") == 0)
-      {
-        printf("(%i) Using omega value from command line\n", proc_rank);
-        omegas = malloc(sizeof(double));
-        omegas[0] = atof(argv[4]);
-        omega_length = 1;
-      }
+      while (fgets(line, sizeof(line), f) != NULL)
+        if (strncmp(line, "model name", 10) == 0 && (tab = strchr(line, ':')) != NULL)
+        {
+          sscanf(tab + 1, " %255[^\n]", cpu);
+          break;
+        }
+      fclose(f);
+    }
+    /* dim of rank 0 as Setup_Grid computes it */
+    sprintf(key, "cpu=%s;dim=%ix%i;ranks=%i;threads=%i;loops=%i", cpu, gridsizes[grid_size_idx] / P_grid[X_DIR] + 2,
+            gridsizes[grid_size_idx] / P_grid[Y_DIR] + 2, P, max_threads, allowed);
 
-      if (strcmp(argv[l], "-omegas") == 0)
+    if ((f = fopen(tuning_cache, "r")) != NULL)
+    {
+      while (fgets(line, sizeof(line), f) != NULL)
+        if ((tab = strchr(line, '\t')) != NULL && tab - line == (long)strlen(key) &&
+            strncmp(line, key, tab - line) == 0 && sscanf(tab + 1, "%i %i", &tuned[1], &tuned[2]) == 2)
+          tuned[0] = 1;
+      fclose(f);
+    }
+  }
+  MPI_Bcast(tuned, 3, MPI_INT, 0, grid_comm);
+
+  if (tuned[0])
+  {
+    best_loop = tuned[1];
+    best_threads = tuned[2];
+  }
+  else
+  {
+    for (loop = NAIVE_LOOP; loop <= CHECKERBOARD_LOOP; loop++)
+    {
+      if (!(allowed & (1 << loop)))
+        continue;
+
+      efficient_loop_flag = loop;
+      for (threads = 1;; threads = min(2 * threads, max_threads))
       {
-        printf("(%i) Using omega values from command line\n", proc_rank);
-        omega_start = atof(argv[l + 1]);
-        omega_end = atof(argv[l + 2]);
-        omega_step = atof(argv[l + 3]);
-        omega_length = (int)((omega_end - omega_start) / omega_step) + 1;
-        if (omega_start < 0.0 || omega_start > 2.0 || omega_end < 0.0 || omega_end > 2.0 || omega_step < 0.0 || omega_step > 2.0)
-          Debug("ERROR Omega values outside range [0,2]", 1);
-        omegas = malloc(omega_length * sizeof(double));
-        for (i = 0; i < omega_length; i++)
+#ifdef _OPENMP
+        omp_set_num_threads(threads);
+#endif
+        t = Time_Local_Iterations(AUTOTUNE_STEPS, NULL);
+        MPI_Allreduce(MPI_IN_PLACE, &t, 1, MPI_DOUBLE, MPI_MAX, grid_comm);
+        if (proc_rank == 0)
+          printf("(%i) Loop %-12s threads %3i: %.3e s per iteration\n", proc_rank, loop_names[loop], threads, t);
+        if (best_t == 0.0 || t < best_t)
         {
-          omegas[i] = omega_start + (double)i * omega_step;
+          best_t = t;
+          best_loop = loop;
+          best_threads = threads;
+        }
+        if (threads == max_threads)
+          break;
+      }
+    }
+
+    if (proc_rank == 0)
+    {
+      if ((f = fopen(tuning_cache, "a")) == NULL)
+        Debug("Error opening tuning cache", 1);
+      fprintf(f, "%s\t%i %i\n", key, best_loop, best_threads);
+      fclose(f);
+    }
+  }
+
+  efficient_loop_flag = best_loop;
+  n_threads = best_threads;
+#ifdef _OPENMP
+  omp_set_num_threads(n_threads);
+#endif
+  if (proc_rank == 0)
+    printf("(%i) Using %s loop with %i threads%s\n", proc_rank, loop_names[efficient_loop_flag], n_threads,
+           tuned[0] ? " from the tuning cache" : "");
+}
+
+/*
+ * Choose P_grid for "auto": the time per iteration of every factorization
+ * of P is predicted for the largest grid size as the SOR iterations timed on
+ * the subgrid of each process plus two halo exchanges per sweep, each
+ * border costing alpha + beta * bytes with alpha and beta fitted to a
+ * ping-pong between the first two processes. The slowest process decides.
+ */
+void Select_Proc_Grid()
+{
+  int px, best_px = 1, largest = 0, i, k, r;
+  int has_dest[4], border_bytes[4];
+  double size[2], pingpong[2], alpha, beta, t;
+  double local[3], pred[3]; /* compute, exchange and total seconds per iteration */
+  double best_iter = 0.0;
+  char *buf;
+  MPI_Comm old_comm;
+
+  if (!proc_grid_auto)
+    return;
+
+  for (i = 1; i < grid_length; i++)
+    if (gridsizes[i] > gridsizes[largest])
+      largest = i;
+
+  /* an empty message and a border of the largest grid */
+  size[0] = 8;
+  size[1] = 8.0 * gridsizes[largest];
+  if ((buf = calloc(size[1], 1)) == NULL)
+    Debug("Select_Proc_Grid : calloc(buf) failed", 1);
+  for (k = 0; k < 2; k++)
+  {
+    MPI_Barrier(grid_comm);
+    t = MPI_Wtime();
+    for (r = 0; r < PROC_GRID_PINGPONGS && P > 1; r++)
+    {
+      if (proc_rank == 0)
+      {
+        MPI_Send(buf, size[k], MPI_BYTE, 1, 0, grid_comm);
+        MPI_Recv(buf, size[k], MPI_BYTE, 1, 0, grid_comm, &status);
+      }
+      else if (proc_rank == 1)
+      {
+        MPI_Recv(buf, size[k], MPI_BYTE, 0, 0, grid_comm, &status);
+        MPI_Send(buf, size[k], MPI_BYTE, 0, 0, grid_comm);
+      }
+    }
+    pingpong[k] = (MPI_Wtime() - t) / (2 * PROC_GRID_PINGPONGS);
+  }
+  free(buf);
+  MPI_Bcast(pingpong, 2, MPI_DOUBLE, 0, grid_comm);
+  beta = max(0.0, (pingpong[1] - pingpong[0]) / (size[1] - size[0]));
+  alpha = max(0.0, pingpong[0] - beta * size[0]);
+  if (proc_rank == 0 && group == 0)
+    printf("(%i) Message time %.3e s + %.3e s per byte\n", proc_rank, alpha, beta);
+
+  grid_size_idx = largest;
+  sweep = sweeps[0];
+  omega = omegas[0];
+
+  for (px = 1; px <= P; px++)
+  {
+    if (P % px != 0)
+      continue;
+
+    /* the coordinates MPI_Cart_create gives without reordering */
+    P_grid[X_DIR] = px;
+    P_grid[Y_DIR] = P / px;
+    proc_coord[X_DIR] = proc_rank / P_grid[Y_DIR];
+    proc_coord[Y_DIR] = proc_rank % P_grid[Y_DIR];
+    has_dest[TO_TOP] = proc_coord[Y_DIR] > 0;
+    has_dest[TO_BOTTOM] = proc_coord[Y_DIR] < P_grid[Y_DIR] - 1;
+    has_dest[TO_LEFT] = proc_coord[X_DIR] > 0;
+    has_dest[TO_RIGHT] = proc_coord[X_DIR] < P_grid[X_DIR] - 1;
+
+    local[0] = Time_Local_Iterations(PROC_GRID_STEPS, border_bytes);
+    local[1] = 0.0;
+    for (i = 0; i < 4; i++)
+      if (has_dest[i])
+        local[1] += alpha + beta * border_bytes[i];
+    local[1] *= 2.0 / sweep;
+    local[2] = local[0] + local[1];
+    MPI_Allreduce(local, pred, 3, MPI_DOUBLE, MPI_MAX, grid_comm);
+
+    if (proc_rank == 0 && group == 0)
+      printf("(%i) Process grid %ix%i: predicted %.3e s compute + %.3e s exchange = %.3e s per iteration\n",
+             proc_rank, P_grid[X_DIR], P_grid[Y_DIR], pred[0], pred[1], pred[2]);
+    if (px == 1 || pred[2] < best_iter)
+    {
+      best_iter = pred[2];
+      best_px = px;
+    }
+  }
+
+  grid_size_idx = 0;
+
+  /* every group of an ensemble takes the grid of the first one */
+  MPI_Bcast(&best_px, 1, MPI_INT, 0, ensemble_comm);
+  MPI_Bcast(&best_iter, 1, MPI_DOUBLE, 0, ensemble_comm);
+  P_grid[X_DIR] = best_px;
+  P_grid[Y_DIR] = P / best_px;
+  predicted_iter_time = best_iter;
+  predicted_gridsize = gridsizes[largest];
+
+  old_comm = grid_comm;
+  MPI_Comm_free(&ensemble_comm);
+  MPI_Comm_free(&node_comm);
+  Setup_Cart_Grid(old_comm);
+  MPI_Comm_free(&old_comm);
+  if (proc_rank == 0)
+    printf("(%i) Using process grid %ix%i\n", proc_rank, P_grid[X_DIR], P_grid[Y_DIR]);
+}
+
+void Get_CLIs(int argc, char **argv)
+{
+  int l, i;
+  l = 0;
+  double omega_start, omega_end, omega_step;
+  int grid_start, grid_end, grid_step;
+  int sweep_start, sweep_end, sweep_step;
+
+  // default values (in case no CLI args are specified)
+  gridsizes = malloc(sizeof(int));
+  gridsizes[0] = 100;
+  grid_length = 1;
+  omegas = malloc(sizeof(double));
+  omegas[0] = 1.95;
+  omega_length = 1;
+  sweeps = malloc(sizeof(int));
+  sweeps[0] = 1;
+  sweep_length = 1;
+
+  if (argc > 3)
+  {
+    while (l < argc)
+    {
+      if (strcmp(argv[l], "-omega") == 0)
+      {
+        omegas = malloc(sizeof(double));
+        omega_length = 1;
+        if (strcmp(argv[l + 1], "auto") == 0)
+        {
+          printf("(%i) Estimating the optimal omega\n", proc_rank);
+          omega_mode = OMEGA_AUTO;
+          omegas[0] = 1.0;
+        }
+        else if (strcmp(argv[l + 1], "chebyshev") == 0)
+        {
+          printf("(%i) Estimating omega for Chebyshev accelerated SOR\n", proc_rank);
+          omega_mode = OMEGA_CHEBYSHEV;
+          omegas[0] = 1.0;
+        }
+        else
+        {
+          printf("(%i) Using omega value from command line\n", proc_rank);
+          omega_mode = OMEGA_FIXED;
+          omegas[0] = atof(argv[l + 1]);
+        }
+      }
+
+      if (strcmp(argv[l], "-omegas") == 0)
+      {
+        printf("(%i) Using omega values from command line\n", proc_rank);
+        omega_start = atof(argv[l + 1]);
+        omega_end = atof(argv[l + 2]);
+        omega_step = atof(argv[l + 3]);
+        omega_length = (int)((omega_end - omega_start) / omega_step) + 1;
+        if (omega_start < 0.0 || omega_start > 2.0 || omega_end < 0.0 || omega_end > 2.0 || omega_step < 0.0 || omega_step > 2.0)
+          Debug("ERROR Omega values outside range [0,2]", 1);
+        omegas = malloc(omega_length * sizeof(double));
+        for (i = 0; i < omega_length; i++)
+        {
+          omegas[i] = omega_start + (double)i * omega_step;
         }
       }
 
@@ -499,6 +1796,288 @@ void Get_CLIs(int argc, char **argv)
         }
       }
 
+      if (strcmp(argv[l], "-checkerboard") == 0)
+      {
+        if (strcmp(argv[l + 1], "true") == 0)
+        {
+          printf("(%i) Using checkerboard loop\n", proc_rank);
+          efficient_loop_flag = CHECKERBOARD_LOOP;
+        }
+        else if (strcmp(argv[l + 1], "false") == 0)
+        {
+          printf("(%i) Not using checkerboard loop\n", proc_rank);
+        }
+        else
+        {
+          printf("(%i) Invalid checkerboard flag, not using checkerboard loop\n", proc_rank);
+        }
+      }
+
+      if (strcmp(argv[l], "-overlap") == 0)
+      {
+        if (strcmp(argv[l + 1], "true") == 0)
+        {
+          printf("(%i) Overlapping halo exchange with computation\n", proc_rank);
+          overlap_flag = 1;
+        }
+        else if (strcmp(argv[l + 1], "false") == 0)
+        {
+          printf("(%i) Not overlapping halo exchange with computation\n", proc_rank);
+          overlap_flag = 0;
+        }
+        else
+        {
+          printf("(%i) Invalid overlap flag, not overlapping halo exchange\n", proc_rank);
+          overlap_flag = 0;
+        }
+      }
+
+      if (strcmp(argv[l], "-colour-halo") == 0)
+      {
+        if (strcmp(argv[l + 1], "true") == 0)
+        {
+          printf("(%i) Exchanging only the colour just updated\n", proc_rank);
+          colour_halo_flag = 1;
+        }
+        else if (strcmp(argv[l + 1], "false") == 0)
+        {
+          printf("(%i) Exchanging both colours\n", proc_rank);
+          colour_halo_flag = 0;
+        }
+        else
+        {
+          printf("(%i) Invalid colour halo flag, exchanging only the colour just updated\n", proc_rank);
+          colour_halo_flag = 1;
+        }
+      }
+
+      if (strcmp(argv[l], "-deep-halo") == 0)
+      {
+        if (strcmp(argv[l + 1], "true") == 0)
+        {
+          printf("(%i) Using deep halos, exchanging every sweep iterations\n", proc_rank);
+          deep_halo_flag = 1;
+        }
+        else if (strcmp(argv[l + 1], "false") == 0)
+        {
+          printf("(%i) Not using deep halos\n", proc_rank);
+          deep_halo_flag = 0;
+        }
+        else
+        {
+          printf("(%i) Invalid deep halo flag, not using deep halos\n", proc_rank);
+          deep_halo_flag = 0;
+        }
+      }
+
+      if (strcmp(argv[l], "-solver") == 0)
+      {
+        for (i = 0; i < N_SOLVERS; i++)
+          if (strcmp(argv[l + 1], solver_names[i]) == 0)
+            break;
+        if (i < N_SOLVERS)
+        {
+          printf("(%i) Using %s solver\n", proc_rank, solver_names[i]);
+          solver = i;
+        }
+        else
+        {
+          printf("(%i) Invalid solver, using sor\n", proc_rank);
+          solver = SOLVER_SOR;
+        }
+      }
+
+      if (strcmp(argv[l], "-slow-rank") == 0)
+      {
+        slow_rank = atoi(argv[l + 1]);
+        slow_time = atof(argv[l + 2]);
+        if (slow_time < 0.0)
+          Debug("ERROR Slow rank delay outside range [0,inf]", 1);
+        printf("(%i) Delaying process %i by %g s per iteration\n", proc_rank, slow_rank, slow_time);
+      }
+
+      if (strcmp(argv[l], "-precision") == 0)
+      {
+        for (i = 0; i < 2; i++)
+          if (strcmp(argv[l + 1], precision_names[i]) == 0)
+            break;
+        if (i < 2)
+        {
+          printf("(%i) Using %s precision\n", proc_rank, precision_names[i]);
+          precision = i;
+        }
+        else
+        {
+          printf("(%i) Invalid precision, using double\n", proc_rank);
+          precision = PREC_DOUBLE;
+        }
+      }
+
+      if (strcmp(argv[l], "-check-every") == 0)
+      {
+        printf("(%i) Using convergence check interval from command line\n", proc_rank);
+        check_every = atoi(argv[l + 1]);
+        if (check_every < 1)
+          Debug("ERROR Convergence check interval outside range [1,inf]", 1);
+      }
+
+      if (strcmp(argv[l], "-adaptive-exchange") == 0)
+      {
+        adaptive_fraction = atof(argv[l + 1]);
+        if (adaptive_fraction < 0.0)
+          Debug("ERROR Adaptive exchange fraction outside range [0,inf]", 1);
+        if (adaptive_fraction > 0.0)
+          printf("(%i) Exchanging borders that changed by more than %g times the error\n", proc_rank, adaptive_fraction);
+        else
+          printf("(%i) Exchanging borders every sweep iterations\n", proc_rank);
+      }
+
+      if (strcmp(argv[l], "-active-set") == 0)
+      {
+        active_set_factor = atof(argv[l + 1]);
+        /* above 1 the skipped tiles would fail the confirming iteration */
+        if (active_set_factor < 0.0 || active_set_factor > 1.0)
+          Debug("ERROR Active set factor outside range [0,1]", 1);
+        if (active_set_factor > 0.0)
+          printf("(%i) Skipping tiles that change by less than %g times the precision goal\n", proc_rank, active_set_factor);
+        else
+          printf("(%i) Updating all tiles\n", proc_rank);
+      }
+
+      if (strcmp(argv[l], "-check-pipelined") == 0)
+      {
+        if (strcmp(argv[l + 1], "true") == 0)
+        {
+          printf("(%i) Pipelining the convergence check\n", proc_rank);
+          check_pipelined_flag = 1;
+        }
+        else if (strcmp(argv[l + 1], "false") == 0)
+        {
+          printf("(%i) Not pipelining the convergence check\n", proc_rank);
+          check_pipelined_flag = 0;
+        }
+        else
+        {
+          printf("(%i) Invalid check pipelined flag, not pipelining the convergence check\n", proc_rank);
+          check_pipelined_flag = 0;
+        }
+      }
+
+      if (strcmp(argv[l], "-checkpoint") == 0)
+      {
+        checkpoint_every = atoi(argv[l + 1]);
+        if (checkpoint_every < 0)
+          Debug("ERROR Checkpoint interval outside range [0,inf]", 1);
+        printf("(%i) Checkpointing every %i iterations\n", proc_rank, checkpoint_every);
+      }
+
+      if (strcmp(argv[l], "-checkpoint-dir") == 0)
+      {
+        printf("(%i) Using checkpoint directory from command line\n", proc_rank);
+        checkpoint_dir = argv[l + 1];
+      }
+
+      if (strcmp(argv[l], "-restart") == 0)
+      {
+        if (strcmp(argv[l + 1], "true") == 0)
+        {
+          printf("(%i) Restarting from the last checkpoint\n", proc_rank);
+          restart_flag = 1;
+        }
+        else if (strcmp(argv[l + 1], "false") == 0)
+        {
+          printf("(%i) Not restarting\n", proc_rank);
+          restart_flag = 0;
+        }
+        else
+        {
+          printf("(%i) Invalid restart flag, not restarting\n", proc_rank);
+          restart_flag = 0;
+        }
+      }
+
+      if (strcmp(argv[l], "-perf") == 0)
+      {
+        if (strcmp(argv[l + 1], "true") == 0)
+        {
+          printf("(%i) Counting hardware events\n", proc_rank);
+          perf_flag = 1;
+        }
+        else if (strcmp(argv[l + 1], "false") == 0)
+        {
+          printf("(%i) Not counting hardware events\n", proc_rank);
+          perf_flag = 0;
+        }
+        else
+        {
+          printf("(%i) Invalid perf flag, not counting hardware events\n", proc_rank);
+          perf_flag = 0;
+        }
+      }
+
+      if (strcmp(argv[l], "-warm-start") == 0)
+      {
+        if (strcmp(argv[l + 1], "true") == 0)
+        {
+          printf("(%i) Starting every grid size from the solution on the previous one\n", proc_rank);
+          warm_start_flag = 1;
+        }
+        else if (strcmp(argv[l + 1], "false") == 0)
+        {
+          printf("(%i) Starting every grid size from zero\n", proc_rank);
+          warm_start_flag = 0;
+        }
+        else
+        {
+          printf("(%i) Invalid warm start flag, starting from zero\n", proc_rank);
+          warm_start_flag = 0;
+        }
+      }
+
+      if (strcmp(argv[l], "-autotune") == 0)
+      {
+        if (strcmp(argv[l + 1], "true") == 0)
+        {
+          printf("(%i) Tuning the loop variant and threads per grid size\n", proc_rank);
+          autotune_flag = 1;
+        }
+        else if (strcmp(argv[l + 1], "false") == 0)
+        {
+          printf("(%i) Not tuning\n", proc_rank);
+          autotune_flag = 0;
+        }
+        else
+        {
+          printf("(%i) Invalid autotune flag, not tuning\n", proc_rank);
+          autotune_flag = 0;
+        }
+      }
+
+      if (strcmp(argv[l], "-tuning-cache") == 0)
+      {
+        printf("(%i) Using tuning cache from command line\n", proc_rank);
+        tuning_cache = argv[l + 1];
+      }
+
+      if (strcmp(argv[l], "-halo") == 0)
+      {
+        for (i = 0; i <= HALO_AUTO; i++)
+          if (strcmp(argv[l + 1], halo_names[i]) == 0)
+            break;
+        if (i <= HALO_AUTO)
+        {
+          printf("(%i) Using %s halo exchange\n", proc_rank, halo_names[i]);
+          halo_engine = (i == HALO_AUTO) ? HALO_DATATYPE : i;
+          halo_auto_flag = (i == HALO_AUTO);
+        }
+        else
+        {
+          printf("(%i) Invalid halo exchange, using datatype\n", proc_rank);
+          halo_engine = HALO_DATATYPE;
+          halo_auto_flag = 0;
+        }
+      }
+
       if (strcmp(argv[l], "-latency") == 0)
       {
         if (strcmp(argv[l + 1], "true") == 0)
@@ -518,6 +2097,23 @@ void Get_CLIs(int argc, char **argv)
         }
       }
       
+      if (strcmp(argv[l], "-batch") == 0)
+      {
+        /* the problem files up to the next option */
+        batch_files = &argv[l + 1];
+        for (batch_size = 0; l + 1 + batch_size < argc && argv[l + 1 + batch_size][0] != '-'; batch_size++)
+          ;
+        if (batch_size == 0)
+          Debug("ERROR -batch needs at least one problem file", 1);
+        printf("(%i) Solving a batch of %i problems\n", proc_rank, batch_size);
+      }
+
+      if (strcmp(argv[l], "-ensemble") == 0)
+      {
+        /* the groups were formed by Setup_Proc_Grid */
+        printf("(%i) Running %i process grids concurrently, this is group %i\n", proc_rank, n_groups, group);
+      }
+
       if (strcmp(argv[l], "-timeviter") == 0)
       {
         if (strcmp(argv[l + 1], "true") == 0)
@@ -544,46 +2140,178 @@ void Get_CLIs(int argc, char **argv)
   {
     printf("(%i) No CLI args specified, using default values for grid size and omega\n", proc_rank);
   }
+
+  if (deep_halo_flag && (efficient_loop_flag == CHECKERBOARD_LOOP || overlap_flag))
+    Debug("ERROR -deep-halo can not be combined with -checkerboard or -overlap", 1);
+  if (deep_halo_flag && (check_every > 1 || check_pipelined_flag))
+    Debug("ERROR -deep-halo checks convergence once per exchange, it can not be combined with -check-every or -check-pipelined", 1);
+  if ((solver == SOLVER_VCYCLE || solver == SOLVER_FMG) &&
+      (efficient_loop_flag != EFFICIENT_LOOP || overlap_flag || deep_halo_flag || check_every > 1 || check_pipelined_flag))
+    Debug("ERROR -solver vcycle and fmg smooth with the efficient loop, without -overlap, -deep-halo or lagged convergence checks", 1);
+  if (omega_mode != OMEGA_FIXED && (solver != SOLVER_SOR || deep_halo_flag || check_every > 1 || check_pipelined_flag))
+    Debug("ERROR -omega auto and chebyshev need the error of every iteration, they can not be combined with -solver, -deep-halo or lagged convergence checks", 1);
+  if (precision == PREC_MIXED && (efficient_loop_flag != EFFICIENT_LOOP || deep_halo_flag || solver != SOLVER_SOR))
+    Debug("ERROR -precision mixed runs the efficient loop, it can not be combined with -deep-halo or -solver", 1);
+  if ((halo_engine != HALO_DATATYPE || halo_auto_flag) && overlap_flag)
+    Debug("ERROR -overlap posts its own nonblocking exchange, it can not be combined with -halo", 1);
+  if (n_groups > 1 && (write_output_flag || track_errors || latency_flag || timeviter_flag || active_set_factor > 0.0))
+    Debug("ERROR -ensemble only records benchmark and sweep results, the files of single runs do not name their configuration", 1);
+  if ((checkpoint_every || restart_flag) && (omega_mode != OMEGA_FIXED || precision != PREC_DOUBLE || deep_halo_flag ||
+                                             solver != SOLVER_SOR || check_pipelined_flag || n_groups > 1))
+    Debug("ERROR -checkpoint and -restart save phi of the SOR iteration with a fixed omega in double precision, without -deep-halo, -check-pipelined or -ensemble", 1);
+
+  if (solver == SOLVER_ASYNC && (overlap_flag || deep_halo_flag || check_every > 1 || check_pipelined_flag ||
+                                 sweep_length > 1 || sweeps[0] != 1 || halo_engine != HALO_DATATYPE ||
+                                 halo_auto_flag || track_errors || latency_flag))
+    Debug("ERROR -solver async has its own one-sided exchange and termination check, it can not be combined with -overlap, -deep-halo, -check-every, -check-pipelined, -sweeps, -halo, -errors or -latency", 1);
+  if (adaptive_fraction > 0.0 && (sweep_length > 1 || sweeps[0] != 1 || check_every > 1 || check_pipelined_flag ||
+                                  efficient_loop_flag == CHECKERBOARD_LOOP || precision != PREC_DOUBLE ||
+                                  overlap_flag || deep_halo_flag || solver != SOLVER_SOR ||
+                                  halo_engine != HALO_DATATYPE || halo_auto_flag ||
+                                  checkpoint_every || restart_flag || n_groups > 1))
+    Debug("ERROR -adaptive-exchange decides with the error of every iteration on the datatype exchange of phi, it replaces -sweeps and can not be combined with -check-every, -check-pipelined, -checkerboard, -precision, -overlap, -deep-halo, -solver, -halo, -checkpoint, -restart or -ensemble", 1);
+
+  if (batch_size > 0 && (efficient_loop_flag != EFFICIENT_LOOP || precision != PREC_DOUBLE || overlap_flag ||
+                         deep_halo_flag || solver != SOLVER_SOR || omega_mode != OMEGA_FIXED ||
+                         check_every > 1 || check_pipelined_flag || adaptive_fraction > 0.0 ||
+                         halo_engine == HALO_SHARED || halo_auto_flag || checkpoint_every || restart_flag ||
+                         warm_start_flag || track_errors || perf_flag))
+    Debug("ERROR -batch runs the efficient loop in double precision with a fixed omega and checks every iteration, it can not be combined with -checkerboard, -precision, -overlap, -deep-halo, -solver, -omega auto, -check-every, -check-pipelined, -adaptive-exchange, -halo shared or auto, -checkpoint, -restart, -warm-start, -errors or -perf", 1);
+
+  if (active_set_factor > 0.0 && (efficient_loop_flag != EFFICIENT_LOOP || precision != PREC_DOUBLE ||
+                                  overlap_flag || deep_halo_flag || solver != SOLVER_SOR || batch_size > 0 ||
+                                  omega_mode != OMEGA_FIXED || check_every > 1 || check_pipelined_flag ||
+                                  adaptive_fraction > 0.0 || perf_flag))
+    Debug("ERROR -active-set chooses the tiles of every iteration in Solve, it runs the efficient loop in double precision and can not be combined with -checkerboard, -precision, -overlap, -deep-halo, -solver, -batch, -omega auto, -check-every, -check-pipelined, -adaptive-exchange or -perf", 1);
+
+  if (warm_start_flag && n_groups > 1)
+    Debug("ERROR -warm-start continues from the last run of the same process grid, it can not be combined with -ensemble", 1);
+
+  if (perf_flag && (!benchmark_flag || deep_halo_flag || solver != SOLVER_SOR || n_groups > 1))
+    Debug("ERROR -perf counts the SOR loop of Solve into the benchmark files, it needs -benchmark and can not be combined with -deep-halo, -solver or -ensemble", 1);
+
+  /* node-local scratch of the job if there is one */
+  if (checkpoint_dir == NULL)
+    checkpoint_dir = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+}
+
+/* colour of the points Do_Step(parity) updates, see Do_Step_Checkerboard */
+int Step_Colour(int parity)
+{
+  return efficient_loop_flag ? 1 - parity : parity;
 }
 
 double Do_Step(int parity)
 {
-  int x, y;
-  double old_phi;
-  double max_err = 0.0;
-  int x_parity;
+  if (tile_delta != NULL)
+    return Active_Step(parity);
 
   /* calculate interior of grid */
-  if (efficient_loop_flag)
+  return Do_Step_Region(parity, 1, dim[X_DIR] - 1, 1, dim[Y_DIR] - 1);
+}
+
+/* points that do not read a halo cell */
+double Do_Step_Interior(int parity)
+{
+  return Do_Step_Region(parity, 2, dim[X_DIR] - 2, 2, dim[Y_DIR] - 2);
+}
+
+/* one-cell frame along the halos, the complement of Do_Step_Interior */
+double Do_Step_Frame(int parity)
+{
+  double max_err, err;
+
+  /* bottom and top rows */
+  max_err = Do_Step_Region(parity, 1, 2, 1, dim[Y_DIR] - 1);
+  if (dim[X_DIR] - 2 > 1)
   {
-    for (x = 1; x < dim[X_DIR] - 1; x++)
+    err = Do_Step_Region(parity, dim[X_DIR] - 2, dim[X_DIR] - 1, 1, dim[Y_DIR] - 1);
+    max_err = max(max_err, err);
+  }
+
+  /* left and right columns without the corners */
+  err = Do_Step_Region(parity, 2, dim[X_DIR] - 2, 1, 2);
+  max_err = max(max_err, err);
+  if (dim[Y_DIR] - 2 > 1)
+  {
+    err = Do_Step_Region(parity, 2, dim[X_DIR] - 2, dim[Y_DIR] - 2, dim[Y_DIR] - 1);
+    max_err = max(max_err, err);
+  }
+
+  return max_err;
+}
+
+/* update the points of one colour in [x_lo, x_hi) x [y_lo, y_hi) */
+double Do_Step_Region(int parity, int x_lo, int x_hi, int y_lo, int y_hi)
+{
+  int x, y, k, lo, hi;
+  double old_phi;
+  double max_err = 0.0;
+  int x_parity;
+
+  if (efficient_loop_flag == CHECKERBOARD_LOOP)
+    return Do_Step_Checkerboard(parity, x_lo, x_hi, y_lo, y_hi);
+  if (phi_f != NULL)
+    return Do_Step_Float(parity, x_lo, x_hi, y_lo, y_hi);
+
+  if (efficient_loop_flag && rhs_phi != NULL)
+  {
+    /* multigrid correction: 4 phi - (sum of the neighbours) = rhs_phi */
+#pragma omp parallel for private(y, k, lo, hi, old_phi, x_parity) reduction(max : max_err) schedule(static)
+    for (x = x_lo; x < x_hi; x++)
     {
       x_parity = (x + offset[X_DIR] + offset[Y_DIR] + parity) % 2;
-      for (y = 1 + x_parity; y < dim[Y_DIR] - 1; y += 2)
+      for (k = span_ptr[x]; k < span_ptr[x + 1]; k++)
       {
-        // if ((offset[X_DIR] + x + offset[Y_DIR] + y) % 2 == parity && source[x][y] != 1)
-        if (source[x][y] != 1)
+        lo = max(span_lo[k], y_lo);
+        hi = span_hi[k] < y_hi ? span_hi[k] : y_hi;
+        for (y = lo + (lo + 1 + x_parity) % 2; y < hi; y += 2)
         {
           old_phi = phi[x][y];
-          phi[x][y] = (1 - omega) * phi[x][y] + omega * (phi[x + 1][y] + phi[x - 1][y] + phi[x][y + 1] + phi[x][y - 1]) * 0.25;
-          if (max_err < fabs(old_phi - phi[x][y]))
-            max_err = fabs(old_phi - phi[x][y]);
+          phi[x][y] = (1 - omega) * phi[x][y] + omega * (phi[x + 1][y] + phi[x - 1][y] + phi[x][y + 1] + phi[x][y - 1] + rhs_phi[x][y]) * 0.25;
+          max_err = max(max_err, fabs(old_phi - phi[x][y]));
         }
       }
     }
   }
-  else // use inefficient/naive loop over all grid points
+  else if (efficient_loop_flag)
   {
-    for (x = 1; x < dim[X_DIR] - 1; x++)
+#pragma omp parallel for private(y, k, lo, hi, old_phi, x_parity) reduction(max : max_err) schedule(static)
+    for (x = x_lo; x < x_hi; x++)
     {
-      for (y = 1; y < dim[Y_DIR] - 1; y++)
+      x_parity = (x + offset[X_DIR] + offset[Y_DIR] + parity) % 2;
+      for (k = span_ptr[x]; k < span_ptr[x + 1]; k++)
       {
-        if ((offset[X_DIR] + x + offset[Y_DIR] + y) % 2 == parity && source[x][y] != 1)
+        lo = max(span_lo[k], y_lo);
+        hi = span_hi[k] < y_hi ? span_hi[k] : y_hi;
+        /* first point of the span with y % 2 == (1 + x_parity) % 2 */
+        for (y = lo + (lo + 1 + x_parity) % 2; y < hi; y += 2)
         {
           old_phi = phi[x][y];
           phi[x][y] = (1 - omega) * phi[x][y] + omega * (phi[x + 1][y] + phi[x - 1][y] + phi[x][y + 1] + phi[x][y - 1]) * 0.25;
-          if (max_err < fabs(old_phi - phi[x][y]))
-            max_err = fabs(old_phi - phi[x][y]);
+          max_err = max(max_err, fabs(old_phi - phi[x][y]));
+        }
+      }
+    }
+  }
+  else // use inefficient/naive loop over all grid points
+  {
+#pragma omp parallel for private(y, k, lo, hi, old_phi) reduction(max : max_err) schedule(static)
+    for (x = x_lo; x < x_hi; x++)
+    {
+      for (k = span_ptr[x]; k < span_ptr[x + 1]; k++)
+      {
+        lo = max(span_lo[k], y_lo);
+        hi = span_hi[k] < y_hi ? span_hi[k] : y_hi;
+        for (y = lo; y < hi; y++)
+        {
+          if ((offset[X_DIR] + x + offset[Y_DIR] + y) % 2 == parity)
+          {
+            old_phi = phi[x][y];
+            phi[x][y] = (1 - omega) * phi[x][y] + omega * (phi[x + 1][y] + phi[x - 1][y] + phi[x][y + 1] + phi[x][y - 1]) * 0.25;
+            if (max_err < fabs(old_phi - phi[x][y]))
+              max_err = fabs(old_phi - phi[x][y]);
+          }
         }
       }
     }
@@ -592,571 +2320,3770 @@ double Do_Step(int parity)
   return max_err;
 }
 
-void Solve()
+/*
+ * Same update as the efficient loop, but on the compacted colour arrays: the
+ * points of one colour in a row are contiguous, so the inner loop has unit
+ * stride and vectorizes together with the max-reduction. The arithmetic is
+ * evaluated in the same order as in the efficient loop, so both produce
+ * bit-identical grids. Like the efficient loop, Do_Step(parity) updates the
+ * points with (x + y + offset) % 2 != parity.
+ */
+double Do_Step_Checkerboard(int parity, int x_lo, int x_hi, int y_lo, int y_hi)
 {
-  count = 0;
-  double delta;
-  double global_delta;
-  double delta1, delta2;
-
-  // Debug("Solve", 0);
+  int c = 1 - parity;
+  int x, j, j_lo, j_hi, k, s, lo, hi;
+  double old_phi;
+  double max_err = 0.0;
+  double *restrict cur;
+  const double *restrict up, *restrict mid, *restrict down;
 
-  /* give global_delta a higher value then precision_goal */
-  global_delta = 2 * precision_goal;
-  if (proc_rank == 0)
-  {
-    errors = malloc(sizeof(double));
-    errors[0] = global_delta;
-    time_by_iteration = malloc(sizeof(double));
-    time_by_iteration[0] = 0.0;
-    time_by_iteration_size++;
-  }
-  while (global_delta > precision_goal && count < max_iter)
+#pragma omp parallel for private(j, j_lo, j_hi, k, s, lo, hi, old_phi, cur, up, mid, down) reduction(max : max_err) schedule(static)
+  for (x = x_lo; x < x_hi; x++)
   {
-    if (latency_flag)
+    /* y-parity of the first point of this colour in row x */
+    s = (x + offset[X_DIR] + offset[Y_DIR] + c) % 2;
+
+    cur = cb_phi[c] + x * cb_stride;
+    up = cb_phi[parity] + (x - 1) * cb_stride;
+    mid = cb_phi[parity] + x * cb_stride + s;
+    down = cb_phi[parity] + (x + 1) * cb_stride;
+
+    for (k = span_ptr[x]; k < span_ptr[x + 1]; k++)
     {
-      latency = 0.0;
-      byte = 0.0;
+      /* compacted indices j of the points y = 2 * j + s in [lo, hi) */
+      lo = max(span_lo[k], y_lo);
+      hi = span_hi[k] < y_hi ? span_hi[k] : y_hi;
+      j_lo = (lo - s + 1) / 2;
+      j_hi = (hi - 1 - s) / 2;
+
+#pragma omp simd reduction(max : max_err)
+      for (j = j_lo; j <= j_hi; j++)
+      {
+        old_phi = cur[j];
+        cur[j] = (1 - omega) * old_phi + omega * (down[j] + up[j] + mid[j] + mid[j - 1]) * 0.25;
+        max_err = max(max_err, fabs(old_phi - cur[j]));
+      }
     }
+  }
 
-    if (timeviter_flag == 1)
-      iter_time = MPI_Wtime();
+  return max_err;
+}
 
-    delta1 = Do_Step(0);
-    Exchange_Borders();
+/*
+ * The efficient loop on the float copy of phi. The update is evaluated in
+ * float, the change of every point in double, so global_delta stays
+ * comparable with the double sweeps.
+ */
+double Do_Step_Float(int parity, int x_lo, int x_hi, int y_lo, int y_hi)
+{
+  int x, y, k, lo, hi;
+  float old_phi;
+  float omega_f = omega;
+  double max_err = 0.0;
+  int x_parity;
 
-    MPI_Barrier(grid_comm);
+#pragma omp parallel for private(y, k, lo, hi, old_phi, x_parity) reduction(max : max_err) schedule(static)
+  for (x = x_lo; x < x_hi; x++)
+  {
+    x_parity = (x + offset[X_DIR] + offset[Y_DIR] + parity) % 2;
+    for (k = span_ptr[x]; k < span_ptr[x + 1]; k++)
+    {
+      lo = max(span_lo[k], y_lo);
+      hi = span_hi[k] < y_hi ? span_hi[k] : y_hi;
+      for (y = lo + (lo + 1 + x_parity) % 2; y < hi; y += 2)
+      {
+        old_phi = phi_f[x][y];
+        phi_f[x][y] = (1 - omega_f) * phi_f[x][y] + omega_f * (phi_f[x + 1][y] + phi_f[x - 1][y] + phi_f[x][y + 1] + phi_f[x][y - 1]) * 0.25f;
+        max_err = max(max_err, fabs((double)old_phi - (double)phi_f[x][y]));
+      }
+    }
+  }
 
-    delta2 = Do_Step(1);
-    Exchange_Borders();
+  return max_err;
+}
 
-    delta = max(delta1, delta2);
+/* continue the sweeps on a float copy of phi, halos included */
+void Mixed_Precision_Begin()
+{
+  int x, y;
+  double phi_max = 0.0;
 
-    count++;
-    
-    MPI_Allreduce(&delta, &global_delta, 1, MPI_DOUBLE, MPI_MAX, grid_comm);
-    
+  if ((phi_f = malloc(dim[X_DIR] * sizeof(*phi_f))) == NULL)
+    Debug("Mixed_Precision_Begin : malloc(phi_f) failed", 1);
+  if ((phi_f[0] = malloc(dim[X_DIR] * dim[Y_DIR] * sizeof(**phi_f))) == NULL)
+    Debug("Mixed_Precision_Begin : malloc(*phi_f) failed", 1);
+  for (x = 1; x < dim[X_DIR]; x++)
+    phi_f[x] = phi_f[0] + x * dim[Y_DIR];
 
-    if (proc_rank == 0)
+#pragma omp parallel for private(y) reduction(max : phi_max) schedule(static)
+  for (x = 0; x < dim[X_DIR]; x++)
+    for (y = 0; y < dim[Y_DIR]; y++)
     {
-      errors = realloc(errors, (count + 1) * sizeof(double));
-      errors[count] = global_delta;
-      time_by_iteration = realloc(time_by_iteration, (count + 1) * sizeof(double));
-      time_by_iteration[count] = MPI_Wtime()-iter_time;
-      time_by_iteration_size++;
+      phi_f[x][y] = phi[x][y];
+      phi_max = max(phi_max, fabs(phi[x][y]));
     }
+  MPI_Allreduce(&phi_max, &mixed_phi_max, 1, MPI_DOUBLE, MPI_MAX, grid_comm);
+  mixed_best = HUGE_VAL;
+  mixed_best_iter = count;
+
+  MPI_Type_vector(dim[X_DIR] - 2, 1, dim[Y_DIR], MPI_FLOAT, &border_type_f[Y_DIR]);
+  MPI_Type_commit(&border_type_f[Y_DIR]);
+  MPI_Type_vector(dim[Y_DIR] - 2, 1, 1, MPI_FLOAT, &border_type_f[X_DIR]);
+  MPI_Type_commit(&border_type_f[X_DIR]);
+  Setup_Halo_Table((char *)phi_f[0], sizeof(float), border_type_f);
+}
 
-    if (latency_flag)
-    {
-      latencies[count - 1] = latency;
-      bytes[count - 1] = byte;
-      if ((latencies = realloc(latencies, (count + 1) * sizeof(double))) == NULL)
-        Debug("Solve : realloc(latencies) failed", 1);
-      if ((bytes = realloc(bytes, (count + 1) * sizeof(double))) == NULL)
-        Debug("Solve : realloc(bytes) failed", 1);
-      latency_length = count;
-    }
+/* whether the float sweeps have reached the goal or can not get closer to it */
+int Mixed_Precision_Done(double global_delta)
+{
+  if (global_delta < mixed_best)
+  {
+    mixed_best = global_delta;
+    mixed_best_iter = count;
   }
 
-  printf("(%i) Gridsize: %i,  Omega: %.2f, Iterations: %i, Error: %.2e\n", proc_rank, gridsize[X_DIR], omega, count, global_delta);
-  current_iter = count;
+  return global_delta < MIXED_SWITCH_FACTOR * precision_goal ||
+         global_delta < MIXED_FLOOR_FACTOR * FLT_EPSILON * mixed_phi_max / (2.0 - omega) ||
+         count - mixed_best_iter >= MIXED_STALL_ITERS;
 }
 
-void Write_Grid()
+/* copy the float sweeps back into phi and continue in double */
+void Mixed_Precision_End()
 {
   int x, y;
-  FILE *f;
-  double **out;
 
-  if (proc_rank == 0)
-  {
-    if ((out = malloc(gridsize[X_DIR] * sizeof(*out))) == NULL)
-      Debug("Write_Grid : malloc failed", 1);
-    if ((out[0] = malloc(gridsize[X_DIR] * gridsize[Y_DIR] * sizeof(**out))) == NULL)
-      Debug("Write_Grid : malloc failed", 1);
-    for (x = 1; x < gridsize[X_DIR]; x++)
-      out[x] = out[0] + x * gridsize[Y_DIR];
-    for (x = 0; x < gridsize[X_DIR]; x++)
-      for (y = 0; y < gridsize[Y_DIR]; y++)
-        out[x][y] = 0.0;
+  /* an exchange posted by -overlap still writes into phi_f */
+  Exchange_Borders_Finish();
 
-    char fn[200];
-    // sprintf(fn, fn_template, P_grid[X_DIR], P_grid[Y_DIR], gridsize[X_DIR], gridsize[Y_DIR], omega);
-    generate_fn(fn, "output", "phi");
-    if ((f = fopen(fn, "w")) == NULL)
-      Debug("Write_Grid : fopen failed", 1);
+#pragma omp parallel for private(y) schedule(static)
+  for (x = 0; x < dim[X_DIR]; x++)
+    for (y = 0; y < dim[Y_DIR]; y++)
+      phi[x][y] = phi_f[x][y];
+
+  Setup_Halo_Table((char *)phi[0], sizeof(double), border_type);
+  MPI_Type_free(&border_type_f[X_DIR]);
+  MPI_Type_free(&border_type_f[Y_DIR]);
+  free(phi_f[0]);
+  free(phi_f);
+  phi_f = NULL;
+}
 
-    // gather all data from other processes
-    for (int i = 0; i < P; i++)
+double *Checkerboard_Point(int x, int y)
+{
+  return &cb_phi[(x + y + offset[X_DIR] + offset[Y_DIR]) % 2][x * cb_stride + y / 2];
+}
+
+void Checkerboard_Split()
+{
+  int x, y, c;
+
+  /* first touch of the colour arrays, same row distribution as Do_Step */
+#pragma omp parallel for private(y, c) schedule(static)
+  for (x = 0; x < dim[X_DIR]; x++)
+    for (y = 0; y < dim[Y_DIR]; y++)
     {
-      if (i > 0)
+      c = (x + y + offset[X_DIR] + offset[Y_DIR]) % 2;
+      cb_phi[c][x * cb_stride + y / 2] = phi[x][y];
+    }
+}
+
+void Checkerboard_Merge()
+{
+  int x, y;
+
+#pragma omp parallel for private(y) schedule(static)
+  for (x = 0; x < dim[X_DIR]; x++)
+    for (y = 0; y < dim[Y_DIR]; y++)
+      phi[x][y] = *Checkerboard_Point(x, y);
+}
+
+/* update one colour of a deep halo region, only the owned points count for the error */
+double Deep_Halo_Region(int parity, int x_lo, int x_hi, int y_lo, int y_hi)
+{
+  int a, b, xs[4], ys[4];
+  double err, max_err = 0.0;
+  int H = halo_width;
+
+  xs[0] = x_lo;
+  xs[1] = min(max(H, x_lo), x_hi);
+  xs[2] = min(max(dh_dim[X_DIR] - H, x_lo), x_hi);
+  xs[3] = x_hi;
+  ys[0] = y_lo;
+  ys[1] = min(max(H, y_lo), y_hi);
+  ys[2] = min(max(dh_dim[Y_DIR] - H, y_lo), y_hi);
+  ys[3] = y_hi;
+
+  for (a = 0; a < 3; a++)
+    for (b = 0; b < 3; b++)
+      if (xs[a] < xs[a + 1] && ys[b] < ys[b + 1])
       {
-        MPI_Recv(&phi[0][0], dim[X_DIR] * dim[Y_DIR], MPI_DOUBLE, i, 0, grid_comm, &status);
-        MPI_Recv(&offset, 2, MPI_INT, i, 0, grid_comm, &status);
+        err = Do_Step_Region(parity, xs[a], xs[a + 1], ys[b], ys[b + 1]);
+        if (a == 1 && b == 1)
+          max_err = err;
       }
-      for (x = 1; x < dim[X_DIR] - 1; x++)
-        for (y = 1; y < dim[Y_DIR] - 1; y++)
-          out[offset[X_DIR] + x][offset[Y_DIR] + y] = phi[x][y];
-      // fprintf(f, "%i %i %f\n", offset[X_DIR] + x, offset[Y_DIR] + y, phi[x][y]);
-    }
 
-    if (fwrite(out[0], sizeof(double), gridsize[X_DIR] * gridsize[Y_DIR], f) != gridsize[X_DIR] * gridsize[Y_DIR])
+  return max_err;
+}
+
+/*
+ * n_iter red/black iterations on the deep halo copy without communication.
+ * Half-sweep h may only update the points at least h + 1 cells inside the
+ * halo, the outer layers hold stale values by then. The half-sweeps advance
+ * as a wavefront of DEEP_HALO_TILE rows, half-sweep h trailing h rows behind
+ * the front, so the rows of a tile stay in cache across all half-sweeps.
+ * deltas[i] is the local error of iteration i.
+ */
+void Deep_Halo_Block(int n_iter, double *deltas)
+{
+  int f, h, x_lo, x_hi;
+  int n_half = 2 * n_iter;
+  double delta;
+
+  for (h = 0; h < n_iter; h++)
+    deltas[h] = 0.0;
+
+  for (f = 1 + DEEP_HALO_TILE; f < dh_dim[X_DIR] + n_half - 1 + DEEP_HALO_TILE; f += DEEP_HALO_TILE)
+    for (h = 0; h < n_half; h++)
     {
-      Debug("File write error.", 1);
-      exit(1);
+      x_lo = max(f - h - DEEP_HALO_TILE, 1 + h);
+      x_hi = min(f - h, dh_dim[X_DIR] - 1 - h);
+      if (x_lo >= x_hi)
+        continue;
+      delta = Deep_Halo_Region(h % 2, x_lo, x_hi, 1 + h, dh_dim[Y_DIR] - 1 - h);
+      deltas[h / 2] = max(deltas[h / 2], delta);
     }
+}
 
-    fclose(f);
-  }
-  else
+/* let Do_Step_Region work on the deep halo copy, or back on phi */
+void Deep_Halo_Swap()
+{
+  double **tmp_phi;
+  int *tmp_span;
+  int d, tmp;
+
+  tmp_phi = phi;
+  phi = dh_phi;
+  dh_phi = tmp_phi;
+  for (d = X_DIR; d <= Y_DIR; d++)
   {
-    MPI_Send(&phi[0][0], dim[X_DIR] * dim[Y_DIR], MPI_DOUBLE, 0, 0, grid_comm);
-    MPI_Send(&offset, 2, MPI_INT, 0, 0, grid_comm);
+    tmp = offset[d];
+    offset[d] = dh_offset[d];
+    dh_offset[d] = tmp;
   }
+  tmp_span = span_ptr;
+  span_ptr = dh_span_ptr;
+  dh_span_ptr = tmp_span;
+  tmp_span = span_lo;
+  span_lo = dh_span_lo;
+  dh_span_lo = tmp_span;
+  tmp_span = span_hi;
+  span_hi = dh_span_hi;
+  dh_span_hi = tmp_span;
 }
 
-void Benchmark()
+/*
+ * Communication avoiding variant of the iteration in Solve: the halos are
+ * 2 * sweep cells wide and exchanged once per sweep iterations, the halo
+ * points are updated redundantly. The iterates and errors are those of
+ * sweep = 1. When the iteration stops inside a block, the block is undone
+ * and redone up to the last iteration sweep = 1 would have made.
+ */
+double Solve_Deep_Halo()
 {
-  double ***benchmark; /* 3D array holding benchmark results shape 2 x #processors x #omegas*/
-  int benchmark_size, i, j, p;
-  // Debug("Benchmark", 0);
+  int i, n, n_iter, x;
+  int H = halo_width;
+  double global_delta = 2 * precision_goal;
+  double block_time;
+  double *deltas, *global_deltas;
+  double *snapshot = NULL;
+  size_t size = dh_dim[X_DIR] * dh_dim[Y_DIR] * sizeof(double);
+
+  if ((deltas = malloc(sweep * sizeof(double))) == NULL)
+    Debug("Solve_Deep_Halo : malloc(deltas) failed", 1);
+  if ((global_deltas = malloc(sweep * sizeof(double))) == NULL)
+    Debug("Solve_Deep_Halo : malloc(global_deltas) failed", 1);
+  if (sweep > 1 && (snapshot = malloc(size)) == NULL)
+    Debug("Solve_Deep_Halo : malloc(snapshot) failed", 1);
+
+  /* start from phi, the halos hold the initial values of the neighbours:
+     zero apart from the sources */
+  for (x = 0; x < dim[X_DIR]; x++)
+    memcpy(&dh_phi[x + H - 1][H - 1], phi[x], dim[Y_DIR] * sizeof(double));
+  for (i = 0; i < n_src; i++)
+    if (src_x[i] + offset[X_DIR] >= 1 && src_x[i] + offset[X_DIR] <= gridsize[X_DIR] &&
+        src_y[i] + offset[Y_DIR] >= 1 && src_y[i] + offset[Y_DIR] <= gridsize[Y_DIR] &&
+        src_x[i] + H - 1 >= 0 && src_x[i] + H - 1 < dh_dim[X_DIR] &&
+        src_y[i] + H - 1 >= 0 && src_y[i] + H - 1 < dh_dim[Y_DIR])
+      dh_phi[src_x[i] + H - 1][src_y[i] + H - 1] = src_val[i];
+
+  Deep_Halo_Swap();
+
+  /* a warm start is not zero outside the sources, the deep halos need the
+     initial values of the neighbours */
+  if (warm_start_flag)
+    Exchange_Borders();
 
-  benchmark_size = 2 * P * omega_length;
-  if (proc_rank == 0)
+  while (global_delta > precision_goal && count < max_iter)
   {
-    // Allocate memory for the pointers to the rows
-    benchmark = malloc(2 * sizeof(double **));
-    if (benchmark == NULL)
-      Debug("Benchmark : malloc(benchmark) failed", 1);
-    if ((benchmark[0] = malloc(P * sizeof(double *))) == NULL)
-      Debug("Benchmark : malloc(benchmark[0]) failed", 1);
-    if ((benchmark[1] = malloc(P * sizeof(double *))) == NULL)
-      Debug("Benchmark : malloc(benchmark[1]) failed", 1);
-    for (i = 0; i < 2; i++)
+    if (latency_flag)
     {
-      for (p = 0; p < P; p++)
-      {
-        if ((benchmark[i][p] = malloc(omega_length * sizeof(double))) == NULL)
-          Debug("Benchmark : malloc(benchmark[i][p]) failed", 1);
-      }
+      latency = 0.0;
+      byte = 0.0;
     }
 
-    // Assign values to the elements
-    for (i = 0; i < 2; i++)
+    block_time = MPI_Wtime();
+
+    n_iter = min(sweep, max_iter - count);
+    if (n_iter > 1)
+      memcpy(snapshot, phi[0], size);
+    Deep_Halo_Block(n_iter, deltas);
+    MPI_Allreduce(deltas, global_deltas, n_iter, MPI_DOUBLE, MPI_MAX, grid_comm);
+
+    /* number of iterations sweep = 1 makes before it stops */
+    n = 1;
+    while (n < n_iter && global_deltas[n - 1] > precision_goal)
+      n++;
+    if (n < n_iter)
     {
-      for (p = 0; p < P; p++)
-      {
-        for (j = 0; j < omega_length; j++)
-        {
-          benchmark[i][p][j] = 0.0;
-        }
-      }
+      memcpy(phi[0], snapshot, size);
+      Deep_Halo_Block(n, deltas);
     }
 
-    for (j = 0; j < omega_length; j++)
+    /* the exchange happens when count reaches a multiple of sweep */
+    count += n;
+    Exchange_Borders();
+    count -= n;
+
+    block_time = MPI_Wtime() - block_time;
+
+    /* the latency of the block is booked on its first iteration */
+    Record_Errors(global_deltas, count + 1, n, &global_delta);
+    for (i = 0; i < n; i++)
     {
-      benchmark[0][0][j] = wtimes[j];
-      benchmark[1][0][j] = cpu_util[j];
+      count++;
+      Record_Iteration(block_time / n);
+      latency = 0.0;
+      byte = 0.0;
     }
   }
 
-  // gather times
-  if (proc_rank != 0)
+  Deep_Halo_Swap();
+  for (x = 0; x < dim[X_DIR]; x++)
+    memcpy(phi[x], &dh_phi[x + H - 1][H - 1], dim[Y_DIR] * sizeof(double));
+
+  free(deltas);
+  free(global_deltas);
+  free(snapshot);
+
+  return global_delta;
+}
+
+/*
+ * Store the errors global_deltas[0 ... n - 1] of the iterations first ...
+ * first + n - 1. Returns the iteration at which the iteration has converged,
+ * or 0, and sets global_delta to its error.
+ */
+int Record_Errors(double *global_deltas, int first, int n, double *global_delta)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
   {
-    MPI_Send(wtimes, omega_length, MPI_DOUBLE, 0, 0, grid_comm);
+    if (proc_rank == 0 && track_errors)
+      Telemetry_Append(&error_log, &global_deltas[i]);
+    *global_delta = global_deltas[i];
+    if (global_deltas[i] <= precision_goal || first + i == max_iter)
+      return first + i;
   }
-  else
-  {
-    for (p = 1; p < P; p++)
+
+  return 0;
+}
+
+/* every process sends in the first iteration */
+void Adaptive_Begin()
+{
+  int n = 2 * (dim[X_DIR] - 2) + 2 * (dim[Y_DIR] - 2);
+
+  if ((adaptive_sent = malloc(n * sizeof(double))) == NULL)
+    Debug("Adaptive_Begin : malloc(adaptive_sent) failed", 1);
+  if ((adaptive_prev = malloc(n * sizeof(double))) == NULL)
+    Debug("Adaptive_Begin : malloc(adaptive_prev) failed", 1);
+  adaptive_send = 1;
+  for (int i = 0; i < 4; i++)
+    adaptive_recv[i] = 1;
+  adaptive_saved = 0;
+  adaptive_first = 0;
+  Border_Change();
+}
+
+/*
+ * How far the send borders are from what the neighbours hold, plus their
+ * change in the last iteration as the estimate of the next one: the error
+ * the neighbours would see if this process skipped the next iteration.
+ */
+double Border_Change()
+{
+  int x, y, k = 0;
+  double b, change = 0.0, step = 0.0;
+
+  for (x = 1; x < dim[X_DIR] - 1; x++)
+    for (y = 1; y < dim[Y_DIR] - 1; y += max(1, dim[Y_DIR] - 3))
     {
-      MPI_Recv(benchmark[0][p], omega_length, MPI_DOUBLE, p, 0, grid_comm, &status);
+      b = phi[x][y];
+      if (adaptive_send)
+        adaptive_sent[k] = b;
+      change = max(change, fabs(b - adaptive_sent[k]));
+      step = max(step, fabs(b - adaptive_prev[k]));
+      adaptive_prev[k++] = b;
+    }
+  for (x = 1; x < dim[X_DIR] - 1; x += max(1, dim[X_DIR] - 3))
+    for (y = 1; y < dim[Y_DIR] - 1; y++)
+    {
+      b = phi[x][y];
+      if (adaptive_send)
+        adaptive_sent[k] = b;
+      change = max(change, fabs(b - adaptive_sent[k]));
+      step = max(step, fabs(b - adaptive_prev[k]));
+      adaptive_prev[k++] = b;
     }
+
+  return change + step;
+}
+
+/* the error of the iteration, like the MPI_Allreduce of Solve, and whether
+   some process skipped its send in it */
+void Adaptive_Reduce(double *local_delta, double *global_delta)
+{
+  double mine[2], all[2];
+
+  mine[0] = *local_delta;
+  mine[1] = !adaptive_send;
+  MPI_Allreduce(mine, all, 2, MPI_DOUBLE, MPI_MAX, grid_comm);
+  *global_delta = all[0];
+  adaptive_skipped = all[1] > 0.0;
+}
+
+/*
+ * Decide whether this process sends in the next iteration and learn the
+ * decisions of the neighbours. Convergence only counts for an iteration in
+ * which all processes sent, otherwise the next one exchanges everything and
+ * the check is repeated.
+ */
+int Adaptive_Decide(int converged, double global_delta)
+{
+  /* neighbours of grid_comm in MPI order: left, right, top, bottom */
+  static const int source_of[4] = {[TO_TOP] = 3, [TO_BOTTOM] = 2, [TO_LEFT] = 1, [TO_RIGHT] = 0};
+  int i, neighbour_sends[4];
+  double change = Border_Change();
+
+  if (converged && converged < max_iter && adaptive_skipped)
+  {
+    if (!adaptive_first)
+      adaptive_first = converged;
+    adaptive_send = 1;
+    for (i = 0; i < 4; i++)
+      adaptive_recv[i] = 1;
+    return 0;
   }
-  // gather times using MPI_Gather
-  // MPI_Gather(&wtimes[0], omega_length, MPI_DOUBLE, &benchmark[0][proc_rank][0], omega_length, MPI_DOUBLE, 0, grid_comm);
-  MPI_Barrier(grid_comm);
 
-  // gather cpu util
-  if (proc_rank != 0)
+  adaptive_send = change > adaptive_fraction * global_delta;
+  MPI_Neighbor_allgather(&adaptive_send, 1, MPI_INT, neighbour_sends, 1, MPI_INT, grid_comm);
+  for (i = 0; i < 4; i++)
+    adaptive_recv[i] = neighbour_sends[source_of[i]];
+  return converged;
+}
+
+void Adaptive_End()
+{
+  MPI_Allreduce(MPI_IN_PLACE, &adaptive_saved, 1, MPI_LONG, MPI_SUM, grid_comm);
+  if (proc_rank == 0)
+    printf("(%i) Adaptive exchange saved %li messages, %i iterations after the first convergence on stale halos\n",
+           proc_rank, adaptive_saved, adaptive_first ? count - adaptive_first : 0);
+  free(adaptive_sent);
+  free(adaptive_prev);
+}
+
+/* every tile is updated in the first iteration */
+void Active_Begin()
+{
+  int t, n_tiles;
+
+  tile_n[X_DIR] = (dim[X_DIR] - 2 + ACTIVE_TILE_X - 1) / ACTIVE_TILE_X;
+  tile_n[Y_DIR] = (dim[Y_DIR] - 2 + ACTIVE_TILE_Y - 1) / ACTIVE_TILE_Y;
+  n_tiles = tile_n[X_DIR] * tile_n[Y_DIR];
+  if ((tile_delta = malloc((n_tiles + 1) * sizeof(double))) == NULL)
+    Debug("Active_Begin : malloc(tile_delta) failed", 1);
+  if ((tile_drift = malloc((n_tiles + 1) * sizeof(double))) == NULL)
+    Debug("Active_Begin : malloc(tile_drift) failed", 1);
+  if ((active_tiles = malloc((n_tiles + 1) * sizeof(int))) == NULL)
+    Debug("Active_Begin : malloc(active_tiles) failed", 1);
+  if ((active_halo = malloc(2 * (dim[X_DIR] + dim[Y_DIR]) * sizeof(double))) == NULL)
+    Debug("Active_Begin : malloc(active_halo) failed", 1);
+  for (t = 0; t < n_tiles; t++)
   {
-    MPI_Send(cpu_util, omega_length, MPI_DOUBLE, 0, 0, grid_comm);
+    tile_delta[t] = HUGE_VAL;
+    tile_drift[t] = 0.0;
   }
-  else
+  n_active_tiles = 0;
+  active_verify = 0;
+  active_updates = 0;
+  active_possible = 0;
+  active_verifies = 0;
+}
+
+/* save the halo points next to edge tile (i, j), in active_halo the bottom
+   and top halo row, then the left and right halo column, without corners */
+void Active_Save_Halo(int i, int j)
+{
+  int x, y, n_x = dim[X_DIR] - 2, n_y = dim[Y_DIR] - 2;
+  int x_lo = 1 + i * ACTIVE_TILE_X, x_hi = min(x_lo + ACTIVE_TILE_X, dim[X_DIR] - 1);
+  int y_lo = 1 + j * ACTIVE_TILE_Y, y_hi = min(y_lo + ACTIVE_TILE_Y, dim[Y_DIR] - 1);
+
+  for (y = y_lo; y < y_hi; y++)
   {
-    for (p = 1; p < P; p++)
-    {
-      MPI_Recv(benchmark[1][p], omega_length, MPI_DOUBLE, p, 0, grid_comm, &status);
-    }
+    if (i == 0)
+      active_halo[y - 1] = phi[0][y];
+    if (i == tile_n[X_DIR] - 1)
+      active_halo[n_y + y - 1] = phi[dim[X_DIR] - 1][y];
   }
-  // MPI_Gather(&cpu_util[0], omega_length, MPI_DOUBLE, &benchmark[1][proc_rank][0], omega_length, MPI_DOUBLE, 0, grid_comm);
-  MPI_Barrier(grid_comm);
+  for (x = x_lo; x < x_hi; x++)
+  {
+    if (j == 0)
+      active_halo[2 * n_y + x - 1] = phi[x][0];
+    if (j == tile_n[Y_DIR] - 1)
+      active_halo[2 * n_y + n_x + x - 1] = phi[x][dim[Y_DIR] - 1];
+  }
+}
 
-  if (proc_rank == 0)
+/* largest change of a halo point next to edge tile (i, j) since its last update */
+double Active_Halo_Change(int i, int j)
+{
+  int x, y, n_x = dim[X_DIR] - 2, n_y = dim[Y_DIR] - 2;
+  int x_lo = 1 + i * ACTIVE_TILE_X, x_hi = min(x_lo + ACTIVE_TILE_X, dim[X_DIR] - 1);
+  int y_lo = 1 + j * ACTIVE_TILE_Y, y_hi = min(y_lo + ACTIVE_TILE_Y, dim[Y_DIR] - 1);
+  double change = 0.0;
+
+  for (y = y_lo; y < y_hi; y++)
   {
-    // char fn_template[] = "ppoisson_times/procg=%ix%i__gs=%ix%i_wl=%3.2f_wh=%3.2f_nomega=%i_times.dat";
-    char fn[200];
-    generate_fn(fn, "ppoisson_times", "times");
-    FILE *f = fopen(fn, "w");
-    if (f == NULL)
-      Debug("Error opening benchmark file", 1);
+    if (i == 0)
+      change = max(change, fabs(phi[0][y] - active_halo[y - 1]));
+    if (i == tile_n[X_DIR] - 1)
+      change = max(change, fabs(phi[dim[X_DIR] - 1][y] - active_halo[n_y + y - 1]));
+  }
+  for (x = x_lo; x < x_hi; x++)
+  {
+    if (j == 0)
+      change = max(change, fabs(phi[x][0] - active_halo[2 * n_y + x - 1]));
+    if (j == tile_n[Y_DIR] - 1)
+      change = max(change, fabs(phi[x][dim[Y_DIR] - 1] - active_halo[2 * n_y + n_x + x - 1]));
+  }
+  return change;
+}
 
-    for (i = 0; i < 2; i++)
+/*
+ * Choose the tiles of the next iteration. The changes of the tiles of the
+ * last one are added to the drift of their neighbours; a skipped tile keeps
+ * its last change and wakes up once that change plus the drift and the
+ * change of its halo since its last update reach the threshold, so slow
+ * changes add up instead of being compared one iteration at a time.
+ */
+void Active_Select()
+{
+  int i, j, k, t, edge, n_i = tile_n[X_DIR], n_j = tile_n[Y_DIR];
+  double threshold = active_set_factor * precision_goal, record;
+
+  for (k = 0; k < n_active_tiles; k++)
+  {
+    t = active_tiles[k];
+    i = t / n_j;
+    j = t % n_j;
+    if (i > 0)
+      tile_drift[t - n_j] += tile_delta[t];
+    if (i < n_i - 1)
+      tile_drift[t + n_j] += tile_delta[t];
+    if (j > 0)
+      tile_drift[t - 1] += tile_delta[t];
+    if (j < n_j - 1)
+      tile_drift[t + 1] += tile_delta[t];
+  }
+
+  n_active_tiles = 0;
+  for (i = 0; i < n_i; i++)
+    for (j = 0; j < n_j; j++)
     {
-      for (p = 0; p < P; p++)
+      t = i * n_j + j;
+      edge = i == 0 || i == n_i - 1 || j == 0 || j == n_j - 1;
+      if (active_verify || tile_delta[t] + tile_drift[t] >= threshold ||
+          (edge && tile_delta[t] + tile_drift[t] + Active_Halo_Change(i, j) >= threshold))
       {
-        for (j = 0; j < omega_length; j++)
+        active_tiles[n_active_tiles++] = t;
+        tile_delta[t] = 0.0;
+        tile_drift[t] = 0.0;
+        if (edge)
+          Active_Save_Halo(i, j);
+      }
+    }
+
+  active_all = n_active_tiles == n_i * n_j;
+  active_verifies += active_verify;
+  active_verify = 0;
+  active_updates += n_active_tiles;
+  active_possible += n_i * n_j;
+  if (telemetry_on)
+  {
+    record = n_active_tiles;
+    Telemetry_Append(&tile_log, &record);
+  }
+}
+
+/*
+ * The efficient loop of Do_Step_Region on the tiles chosen by Active_Select.
+ * The threads share the tiles, not the rows of a tile, so a tile costs no
+ * parallel region of its own.
+ */
+double Active_Step(int parity)
+{
+  int i, t, x, y, k, lo, hi, x_lo, x_hi, y_lo, y_hi, x_parity;
+  double old_phi, err, max_err = 0.0;
+
+#pragma omp parallel for private(t, x, y, k, lo, hi, x_lo, x_hi, y_lo, y_hi, x_parity, old_phi, err) reduction(max : max_err) schedule(dynamic)
+  for (i = 0; i < n_active_tiles; i++)
+  {
+    t = active_tiles[i];
+    x_lo = 1 + (t / tile_n[Y_DIR]) * ACTIVE_TILE_X;
+    x_hi = min(x_lo + ACTIVE_TILE_X, dim[X_DIR] - 1);
+    y_lo = 1 + (t % tile_n[Y_DIR]) * ACTIVE_TILE_Y;
+    y_hi = min(y_lo + ACTIVE_TILE_Y, dim[Y_DIR] - 1);
+    err = 0.0;
+    for (x = x_lo; x < x_hi; x++)
+    {
+      x_parity = (x + offset[X_DIR] + offset[Y_DIR] + parity) % 2;
+      for (k = span_ptr[x]; k < span_ptr[x + 1]; k++)
+      {
+        lo = max(span_lo[k], y_lo);
+        hi = span_hi[k] < y_hi ? span_hi[k] : y_hi;
+        for (y = lo + (lo + 1 + x_parity) % 2; y < hi; y += 2)
         {
-          fwrite(&benchmark[i][p][j], sizeof(double), 1, f);
+          old_phi = phi[x][y];
+          phi[x][y] = (1 - omega) * phi[x][y] + omega * (phi[x + 1][y] + phi[x - 1][y] + phi[x][y + 1] + phi[x][y - 1]) * 0.25;
+          err = max(err, fabs(old_phi - phi[x][y]));
         }
       }
     }
-    fclose(f);
+    tile_delta[t] = max(tile_delta[t], err);
+    max_err = max(max_err, err);
+  }
 
-    //  save omega values to file
-    generate_fn(fn, "ppoisson_times", "omegas");
-    FILE *f2 = fopen(fn, "w");
-    if (f2 == NULL)
-      Debug("Error opening benchmark file", 1);
+  return max_err;
+}
 
-    for (i = 0; i < omega_length; i++)
+/* convergence with skipped tiles is only accepted after an iteration over all of them */
+int Active_Decide(int converged)
+{
+  int all;
+
+  if (!converged || count >= max_iter)
+    return converged;
+  MPI_Allreduce(&active_all, &all, 1, MPI_INT, MPI_LAND, grid_comm);
+  if (!all)
+  {
+    active_verify = 1;
+    return 0;
+  }
+  return converged;
+}
+
+void Active_End()
+{
+  long totals[2] = {active_updates, active_possible};
+
+  MPI_Allreduce(MPI_IN_PLACE, totals, 2, MPI_LONG, MPI_SUM, grid_comm);
+  if (proc_rank == 0)
+    printf("(%i) Active set updated %li of %li tiles (%.1f%%), %i confirming iterations\n", proc_rank,
+           totals[0], totals[1], 100.0 * totals[0] / max(totals[1], 1), active_verifies);
+  free(tile_delta);
+  free(tile_drift);
+  free(active_tiles);
+  free(active_halo);
+  tile_delta = NULL;
+}
+
+/* store the time and communication of iteration count */
+void Record_Iteration(double iteration_time)
+{
+  double record[3];
+
+  if (latency_flag || timeviter_flag)
+  {
+    record[0] = iteration_time;
+    record[1] = latency;
+    record[2] = byte;
+    Telemetry_Append(&iteration_log, record);
+  }
+}
+
+/* zero-initialized array of dim[X_DIR] x dim[Y_DIR] points, indexed like phi */
+double **Level_Array(int *dim)
+{
+  double **a;
+  int x, y;
+
+  if ((a = malloc(dim[X_DIR] * sizeof(*a))) == NULL)
+    Debug("Level_Array : malloc failed", 1);
+  if ((a[0] = malloc(dim[X_DIR] * dim[Y_DIR] * sizeof(**a))) == NULL)
+    Debug("Level_Array : malloc failed", 1);
+  for (x = 1; x < dim[X_DIR]; x++)
+    a[x] = a[0] + x * dim[Y_DIR];
+
+#pragma omp parallel for private(y) schedule(static)
+  for (x = 0; x < dim[X_DIR]; x++)
+    for (y = 0; y < dim[Y_DIR]; y++)
+      a[x][y] = 0.0;
+
+  return a;
+}
+
+/*
+ * Build the multigrid levels on top of phi. The levels are coarsened on the
+ * process grid of Setup_Proc_Grid until a process would keep fewer than
+ * MG_MIN_LOCAL cells per direction; the next level is then gathered on rank
+ * 0, which coarsens further on its own down to MG_COARSEST cells.
+ */
+void Setup_Multigrid()
+{
+  int d, n_local, n_min;
+  int lo[2], hi[2], box[4];
+  Level *lv, *next;
+
+  if ((levels = malloc(sizeof(Level))) == NULL)
+    Debug("Setup_Multigrid : malloc(levels) failed", 1);
+  n_levels = 1;
+  lv = &levels[0];
+  for (d = X_DIR; d <= Y_DIR; d++)
+  {
+    lv->n[d] = gridsize[d];
+    lv->offset[d] = offset[d];
+    lv->dim[d] = dim[d];
+  }
+  lv->serial = 0;
+  lv->active = 1;
+  lv->gather = 0;
+  lv->u = phi;
+  lv->b = NULL;
+  lv->r = Level_Array(lv->dim);
+  lv->n_fixed = n_src;
+  lv->fixed_x = src_x;
+  lv->fixed_y = src_y;
+  lv->fixed_val = src_val;
+  lv->span_ptr = span_ptr;
+  lv->span_lo = span_lo;
+  lv->span_hi = span_hi;
+  MPI_Type_contiguous(lv->dim[Y_DIR], MPI_DOUBLE, &lv->row_type);
+  MPI_Type_commit(&lv->row_type);
+  MPI_Type_vector(lv->dim[X_DIR] - 2, 1, lv->dim[Y_DIR], MPI_DOUBLE, &lv->col_type);
+  MPI_Type_commit(&lv->col_type);
+
+  while (levels[n_levels - 1].n[X_DIR] > MG_COARSEST && levels[n_levels - 1].n[Y_DIR] > MG_COARSEST)
+  {
+    if ((levels = realloc(levels, (n_levels + 1) * sizeof(Level))) == NULL)
+      Debug("Setup_Multigrid : realloc(levels) failed", 1);
+    lv = &levels[n_levels - 1];
+    next = &levels[n_levels];
+
+    /* coarse cells I with 2 I - 1 in the local grid; with an odd grid size
+       the last fine cell has no parent, so the coarse boundary stays inside
+       the domain */
+    for (d = X_DIR; d <= Y_DIR; d++)
     {
-      fwrite(&omegas[i], sizeof(double), 1, f2);
+      lo[d] = (lv->offset[d] + 3) / 2;
+      hi[d] = min((lv->offset[d] + lv->dim[d] - 1) / 2, lv->n[d] / 2);
+    }
+    n_min = MG_MIN_LOCAL;
+    if (!lv->serial)
+    {
+      n_local = min(hi[X_DIR] - lo[X_DIR] + 1, hi[Y_DIR] - lo[Y_DIR] + 1);
+      MPI_Allreduce(&n_local, &n_min, 1, MPI_INT, MPI_MIN, grid_comm);
     }
 
-    fclose(f2);
+    lv->gather = (P > 1 && !lv->serial && n_min < MG_MIN_LOCAL);
+    next->serial = lv->serial || lv->gather;
+    next->active = !next->serial || proc_rank == 0;
+    next->gather = 0;
+    for (d = X_DIR; d <= Y_DIR; d++)
+    {
+      next->n[d] = lv->gather ? lv->n[d] : lv->n[d] / 2;
+      next->offset[d] = next->serial ? 0 : lo[d] - 1;
+      next->dim[d] = next->serial ? next->n[d] + 2 : hi[d] - lo[d] + 3;
+    }
 
-    generate_fn(fn, "ppoisson_times", "iters");
-    FILE *f3 = fopen(fn, "w");
-    if (f3 == NULL)
-      Debug("Error opening benchmark file", 1);
+    if (lv->gather)
+    {
+      box[0] = lv->offset[X_DIR];
+      box[1] = lv->offset[Y_DIR];
+      box[2] = lv->dim[X_DIR] - 2;
+      box[3] = lv->dim[Y_DIR] - 2;
+      if (proc_rank == 0 && (gather_box = malloc(4 * P * sizeof(int))) == NULL)
+        Debug("Setup_Multigrid : malloc(gather_box) failed", 1);
+      MPI_Gather(box, 4, MPI_INT, gather_box, 4, MPI_INT, 0, grid_comm);
+    }
 
-    for (i = 0; i < omega_length; i++)
+    Setup_Level(next, lv);
+    n_levels++;
+  }
+}
+
+/* allocate a level below fine and find its fixed points */
+void Setup_Level(Level *lv, Level *fine)
+{
+  int i, d, g[2];
+
+  lv->n_fixed = 0;
+  lv->fixed_x = NULL;
+  lv->fixed_y = NULL;
+  lv->fixed_val = NULL;
+  if (!lv->active)
+    return;
+
+  lv->u = Level_Array(lv->dim);
+  lv->b = Level_Array(lv->dim);
+  lv->r = Level_Array(lv->dim);
+
+  /* a coarse cell is fixed if one of its children is */
+  if ((lv->fixed_x = malloc((fine->n_fixed + 1) * sizeof(int))) == NULL)
+    Debug("Setup_Level : malloc(fixed_x) failed", 1);
+  if ((lv->fixed_y = malloc((fine->n_fixed + 1) * sizeof(int))) == NULL)
+    Debug("Setup_Level : malloc(fixed_y) failed", 1);
+  if ((lv->fixed_val = malloc((fine->n_fixed + 1) * sizeof(double))) == NULL)
+    Debug("Setup_Level : malloc(fixed_val) failed", 1);
+  for (i = 0; i < fine->n_fixed; i++)
+  {
+    g[X_DIR] = fine->fixed_x[i] + fine->offset[X_DIR];
+    g[Y_DIR] = fine->fixed_y[i] + fine->offset[Y_DIR];
+    if (g[X_DIR] < 1 || g[X_DIR] > fine->n[X_DIR] || g[Y_DIR] < 1 || g[Y_DIR] > fine->n[Y_DIR])
+      continue;
+    for (d = X_DIR; d <= Y_DIR; d++)
+      if (!fine->gather)
+        g[d] = (g[d] + 1) / 2;
+    lv->fixed_x[lv->n_fixed] = g[X_DIR] - lv->offset[X_DIR];
+    lv->fixed_y[lv->n_fixed] = g[Y_DIR] - lv->offset[Y_DIR];
+    lv->fixed_val[lv->n_fixed] = fine->fixed_val[i];
+    lv->n_fixed++;
+  }
+
+  Build_Spans(lv->dim[X_DIR], 1, lv->dim[X_DIR] - 1, 1, lv->dim[Y_DIR] - 1,
+              lv->n_fixed, lv->fixed_x, lv->fixed_y, 0,
+              &lv->span_ptr, &lv->span_lo, &lv->span_hi);
+
+  MPI_Type_contiguous(lv->dim[Y_DIR], MPI_DOUBLE, &lv->row_type);
+  MPI_Type_commit(&lv->row_type);
+  MPI_Type_vector(lv->dim[X_DIR] - 2, 1, lv->dim[Y_DIR], MPI_DOUBLE, &lv->col_type);
+  MPI_Type_commit(&lv->col_type);
+}
+
+/* let Do_Step work on the level, Level_Select(&levels[0]) returns to phi */
+void Level_Select(Level *lv)
+{
+  int d;
+
+  phi = lv->u;
+  rhs_phi = lv->b;
+  for (d = X_DIR; d <= Y_DIR; d++)
+  {
+    dim[d] = lv->dim[d];
+    offset[d] = lv->offset[d];
+  }
+  span_ptr = lv->span_ptr;
+  span_lo = lv->span_lo;
+  span_hi = lv->span_hi;
+}
+
+/*
+ * Exchange the halos of a, the horizontal exchange also fills the corners.
+ * On the correction levels the halo cells along the domain boundary mirror
+ * the first cell with opposite sign, which puts the zero boundary value on
+ * the cell face. A halo cell one coarse cell away would move the boundary
+ * outwards on every level and make the coarse corrections too large.
+ */
+void Level_Exchange(Level *lv, double **a)
+{
+  int x, y, n_x = lv->dim[X_DIR], n_y = lv->dim[Y_DIR];
+  int mirror = lv->b != NULL;
+
+  if (!lv->serial)
+  {
+    MPI_Sendrecv(&a[1][1], 1, lv->col_type, proc_top, 0,
+                 &a[1][n_y - 1], 1, lv->col_type, proc_bottom, 0, grid_comm, &status);
+    MPI_Sendrecv(&a[1][n_y - 2], 1, lv->col_type, proc_bottom, 0,
+                 &a[1][0], 1, lv->col_type, proc_top, 0, grid_comm, &status);
+  }
+  if (mirror && (lv->serial || proc_bottom == MPI_PROC_NULL))
+    for (x = 1; x < n_x - 1; x++)
+      a[x][n_y - 1] = -a[x][n_y - 2];
+  if (mirror && (lv->serial || proc_top == MPI_PROC_NULL))
+    for (x = 1; x < n_x - 1; x++)
+      a[x][0] = -a[x][1];
+
+  if (!lv->serial)
+  {
+    MPI_Sendrecv(&a[1][0], 1, lv->row_type, proc_left, 0,
+                 &a[n_x - 1][0], 1, lv->row_type, proc_right, 0, grid_comm, &status);
+    MPI_Sendrecv(&a[n_x - 2][0], 1, lv->row_type, proc_right, 0,
+                 &a[0][0], 1, lv->row_type, proc_left, 0, grid_comm, &status);
+  }
+  if (mirror && (lv->serial || proc_right == MPI_PROC_NULL))
+    for (y = 0; y < n_y; y++)
+      a[n_x - 1][y] = -a[n_x - 2][y];
+  if (mirror && (lv->serial || proc_left == MPI_PROC_NULL))
+    for (y = 0; y < n_y; y++)
+      a[0][y] = -a[1][y];
+}
+
+/* red-black Gauss-Seidel sweeps with Do_Step */
+void Level_Smooth(Level *lv, int n_sweeps)
+{
+  int i;
+
+  Level_Select(lv);
+  for (i = 0; i < n_sweeps; i++)
+  {
+    Do_Step(0);
+    Level_Exchange(lv, lv->u);
+    Do_Step(1);
+    Level_Exchange(lv, lv->u);
+  }
+  Level_Select(&levels[0]);
+}
+
+/* r = b - (4 u - sum of the neighbours), zero on the fixed points */
+void Level_Residual(Level *lv)
+{
+  int x, y, k;
+  double **u = lv->u, **b = lv->b, **r = lv->r;
+
+#pragma omp parallel for private(y, k) schedule(static)
+  for (x = 1; x < lv->dim[X_DIR] - 1; x++)
+    for (k = lv->span_ptr[x]; k < lv->span_ptr[x + 1]; k++)
+      for (y = lv->span_lo[k]; y < lv->span_hi[k]; y++)
+        r[x][y] = (b == NULL ? 0.0 : b[x][y]) - 4 * u[x][y] + u[x + 1][y] + u[x - 1][y] + u[x][y + 1] + u[x][y - 1];
+
+  Level_Exchange(lv, r);
+}
+
+/* right hand side of level l + 1: the sum of the residuals of the children */
+void Restrict(int l)
+{
+  Level *lv = &levels[l], *c = &levels[l + 1];
+  int x, y, x0, y0;
+  double **r = lv->r;
+
+#pragma omp parallel for private(y, x0, y0) schedule(static)
+  for (x = 0; x < c->dim[X_DIR]; x++)
+    for (y = 0; y < c->dim[Y_DIR]; y++)
     {
-      fwrite(&iters[i], sizeof(int), 1, f3);
+      c->u[x][y] = 0.0;
+      c->b[x][y] = 0.0;
+      if (x > 0 && x < c->dim[X_DIR] - 1 && y > 0 && y < c->dim[Y_DIR] - 1)
+      {
+        x0 = 2 * (x + c->offset[X_DIR]) - 1 - lv->offset[X_DIR];
+        y0 = 2 * (y + c->offset[Y_DIR]) - 1 - lv->offset[Y_DIR];
+        c->b[x][y] = r[x0][y0] + r[x0 + 1][y0] + r[x0][y0 + 1] + r[x0 + 1][y0 + 1];
+      }
     }
+}
 
-    fclose(f3);
+/* u of level l += bilinear interpolation of u of level l + 1 */
+void Prolong(int l)
+{
+  Level *lv = &levels[l], *c = &levels[l + 1];
+  int x, y, k, gx, gy, cx, cy, sx, sy;
+  double **e = c->u;
+
+#pragma omp parallel for private(y, k, gx, gy, cx, cy, sx, sy) schedule(static)
+  for (x = 1; x < lv->dim[X_DIR] - 1; x++)
+  {
+    /* parent cell and the coarse neighbour on the side of the child, the
+       last cell of an odd grid size has no parent and is left to the smoother */
+    gx = x + lv->offset[X_DIR];
+    if ((gx + 1) / 2 > c->n[X_DIR])
+      continue;
+    cx = (gx + 1) / 2 - c->offset[X_DIR];
+    sx = gx % 2 ? -1 : 1;
+    for (k = lv->span_ptr[x]; k < lv->span_ptr[x + 1]; k++)
+      for (y = lv->span_lo[k]; y < lv->span_hi[k]; y++)
+      {
+        gy = y + lv->offset[Y_DIR];
+        if ((gy + 1) / 2 > c->n[Y_DIR])
+          continue;
+        cy = (gy + 1) / 2 - c->offset[Y_DIR];
+        sy = gy % 2 ? -1 : 1;
+        lv->u[x][y] += 0.5625 * e[cx][cy] + 0.1875 * (e[cx + sx][cy] + e[cx][cy + sy]) + 0.0625 * e[cx + sx][cy + sy];
+      }
   }
 }
 
-void Error_Analysis()
+/* right hand side of level l + 1: the residual of level l, gathered on rank 0 */
+void Gather_Level(int l)
 {
-  // Debug("Error_Analysis", 0);
-  // char fn_template[] = "error_analysis/procg=%ix%i__gs=%ix%i_omega=%3.2f.dat";
-  char fn[200];
-  generate_fn(fn, "error_analysis", "");
-  // sprintf(fn, fn_template, P_grid[X_DIR], P_grid[Y_DIR], gridsize[X_DIR], gridsize[Y_DIR], omega);
+  Level *lv = &levels[l], *c = &levels[l + 1];
+  int x, y, i, p, n;
+  int *counts = NULL, *displs = NULL;
+  double *send, *recv = NULL;
+
+  n = (lv->dim[X_DIR] - 2) * (lv->dim[Y_DIR] - 2);
+  if ((send = malloc(n * sizeof(double))) == NULL)
+    Debug("Gather_Level : malloc(send) failed", 1);
+  for (x = 1, i = 0; x < lv->dim[X_DIR] - 1; x++)
+    for (y = 1; y < lv->dim[Y_DIR] - 1; y++)
+      send[i++] = lv->r[x][y];
+
   if (proc_rank == 0)
   {
-    FILE *f = fopen(fn, "w");
-    if (f == NULL)
-      Debug("Error opening error file", 1);
-
-    for (int i = 0; i < count; i++)
+    counts = malloc(P * sizeof(int));
+    displs = malloc(P * sizeof(int));
+    recv = malloc(c->n[X_DIR] * c->n[Y_DIR] * sizeof(double));
+    if (counts == NULL || displs == NULL || recv == NULL)
+      Debug("Gather_Level : malloc failed", 1);
+    for (p = 0, i = 0; p < P; p++)
     {
-      fwrite(&errors[i], sizeof(double), 1, f);
+      counts[p] = gather_box[4 * p + 2] * gather_box[4 * p + 3];
+      displs[p] = i;
+      i += counts[p];
     }
-    fclose(f);
   }
+  MPI_Gatherv(send, n, MPI_DOUBLE, recv, counts, displs, MPI_DOUBLE, 0, grid_comm);
+
+  if (proc_rank == 0)
+  {
+    for (x = 0; x < c->dim[X_DIR]; x++)
+      for (y = 0; y < c->dim[Y_DIR]; y++)
+        c->u[x][y] = 0.0;
+    for (p = 0, i = 0; p < P; p++)
+      for (x = 1; x <= gather_box[4 * p + 2]; x++)
+        for (y = 1; y <= gather_box[4 * p + 3]; y++)
+          c->b[gather_box[4 * p] + x][gather_box[4 * p + 1] + y] = recv[i++];
+    free(counts);
+    free(displs);
+    free(recv);
+  }
+  free(send);
 }
 
-void Sweep_Analysis()
+/* distribute u of the gathered level l + 1 and add it to, or set, u of level l */
+void Scatter_Level(int l, int add)
 {
-  int sweep_vs_omega_size = omega_length * sweep_length;
-  // Debug("Sweep_Analysis", 0);
+  Level *lv = &levels[l], *c = &levels[l + 1];
+  int x, y, i, p, n;
+  int *counts = NULL, *displs = NULL;
+  double *send = NULL, *recv;
+
+  n = (lv->dim[X_DIR] - 2) * (lv->dim[Y_DIR] - 2);
+  if ((recv = malloc(n * sizeof(double))) == NULL)
+    Debug("Scatter_Level : malloc(recv) failed", 1);
+
   if (proc_rank == 0)
   {
-    char fn[200];
-    generate_fn(fn, "sweep_analysis", "iters");
-    FILE *f = fopen(fn, "w");
-    if (f == NULL)
-      Debug("Error opening sweep file", 1);
+    counts = malloc(P * sizeof(int));
+    displs = malloc(P * sizeof(int));
+    send = malloc(c->n[X_DIR] * c->n[Y_DIR] * sizeof(double));
+    if (counts == NULL || displs == NULL || send == NULL)
+      Debug("Scatter_Level : malloc failed", 1);
+    for (p = 0, i = 0; p < P; p++)
+    {
+      counts[p] = gather_box[4 * p + 2] * gather_box[4 * p + 3];
+      displs[p] = i;
+      for (x = 1; x <= gather_box[4 * p + 2]; x++)
+        for (y = 1; y <= gather_box[4 * p + 3]; y++)
+          send[i++] = c->u[gather_box[4 * p] + x][gather_box[4 * p + 1] + y];
+    }
+  }
+  MPI_Scatterv(send, counts, displs, MPI_DOUBLE, recv, n, MPI_DOUBLE, 0, grid_comm);
 
-    for (int i = 0; i < sweep_length; i++)
+  for (x = 1, i = 0; x < lv->dim[X_DIR] - 1; x++)
+    for (y = 1; y < lv->dim[Y_DIR] - 1; y++, i++)
+      lv->u[x][y] = add ? lv->u[x][y] + recv[i] : recv[i];
+  Level_Exchange(lv, lv->u);
+
+  if (proc_rank == 0)
+  {
+    free(counts);
+    free(displs);
+    free(send);
+  }
+  free(recv);
+}
+
+/* improve u of level l with a V-cycle on A u = b */
+void Vcycle(int l)
+{
+  Level *lv = &levels[l];
+
+  if (!lv->active)
+    return;
+
+  if (l == n_levels - 1)
+  {
+    Level_Smooth(lv, MG_COARSE_SWEEPS);
+  }
+  else if (lv->gather)
+  {
+    /* the same grid on rank 0 does the smoothing */
+    Level_Residual(lv);
+    Gather_Level(l);
+    Vcycle(l + 1);
+    Scatter_Level(l, 1);
+  }
+  else
+  {
+    Level_Smooth(lv, MG_PRE_SWEEPS);
+    Level_Residual(lv);
+    Restrict(l);
+    Vcycle(l + 1);
+    Prolong(l);
+    Level_Exchange(lv, lv->u);
+    Level_Smooth(lv, MG_POST_SWEEPS);
+  }
+}
+
+/*
+ * Full multigrid: solve the problem itself (zero right hand side, fixed
+ * points at their source values) on level l + 1, interpolate it as the
+ * starting value of level l and improve that with one V-cycle.
+ */
+void Full_Multigrid(int l)
+{
+  Level *lv = &levels[l];
+  int i, x, y;
+
+  if (!lv->active)
+    return;
+
+  if (l > 0)
+  {
+    /* b may still hold a residual of an earlier run on this grid */
+    for (x = 0; x < lv->dim[X_DIR]; x++)
+      for (y = 0; y < lv->dim[Y_DIR]; y++)
+      {
+        lv->u[x][y] = 0.0;
+        lv->b[x][y] = 0.0;
+      }
+    for (i = 0; i < lv->n_fixed; i++)
+      if (lv->fixed_x[i] > 0 && lv->fixed_x[i] < lv->dim[X_DIR] - 1 &&
+          lv->fixed_y[i] > 0 && lv->fixed_y[i] < lv->dim[Y_DIR] - 1)
+        lv->u[lv->fixed_x[i]][lv->fixed_y[i]] = lv->fixed_val[i];
+    Level_Exchange(lv, lv->u);
+  }
+
+  if (l < n_levels - 1)
+  {
+    Full_Multigrid(l + 1);
+    if (lv->gather)
     {
-      for (int j = 0; j < omega_length; j++)
+      Scatter_Level(l, 0);
+      return;
+    }
+    Prolong(l);
+    Level_Exchange(lv, lv->u);
+  }
+
+  Vcycle(l);
+}
+
+/* -slow-rank: busy wait, like a process that shares its core */
+void Slow_Down()
+{
+  double t = MPI_Wtime();
+
+  if (proc_rank == slow_rank)
+    while (MPI_Wtime() - t < slow_time)
+      ;
+}
+
+/* put the current borders into the neighbours' receive slots of win and
+   wait for the neighbours' ones, outside of a passive target epoch */
+void Async_Refresh(MPI_Win win, char *stage, int *send_off, MPI_Aint *put_disp)
+{
+  int i;
+
+  MPI_Win_fence(0, win);
+  for (i = 0; i < 4; i++)
+    if (halo_dest[i] != MPI_PROC_NULL)
+    {
+      Halo_Pack(i, stage + send_off[i]);
+      MPI_Put(stage + send_off[i], halo_send_bytes[i], MPI_BYTE, halo_dest[i], put_disp[i],
+              halo_send_bytes[i], MPI_BYTE, win);
+    }
+  MPI_Win_fence(0, win);
+}
+
+/*
+ * Asynchronous (chaotic) variant of the iteration in Solve. Every process
+ * updates both colours, puts its borders into the receive slots of its
+ * neighbours in a passive target epoch without waiting for them and starts
+ * the next iteration with whatever halos have arrived. Convergence is
+ * detected by a rolling MPI_Iallreduce of the local errors and iteration
+ * counts: every process contributes to the k-th reduction and tests it
+ * while it iterates, so all stop after the same one. A synchronous
+ * iteration on consistent halos then confirms the error, otherwise the
+ * asynchronous iteration continues. The iteration count is per process.
+ */
+double Solve_Async()
+{
+  int i, done, size = 0, stage_size = 0;
+  int send_off[4];
+  MPI_Aint recv_off[4], put_disp[4];
+  char *slots, *stage;
+  double delta, delta2, local[2], reduced[2];
+  MPI_Request request = MPI_REQUEST_NULL;
+  MPI_Win win;
+
+  delta = 2 * precision_goal;
+  for (i = 0; i < 4; i++)
+  {
+    MPI_Type_size(halo_send_type[i], &halo_send_bytes[i]);
+    MPI_Type_size(halo_recv_type[i], &halo_recv_bytes[i]);
+    send_off[i] = stage_size;
+    stage_size += halo_send_bytes[i];
+    recv_off[i] = size;
+    size += halo_recv_bytes[i];
+  }
+  if ((stage = malloc(stage_size)) == NULL)
+    Debug("Solve_Async : malloc(stage) failed", 1);
+  MPI_Win_allocate(size, 1, MPI_INFO_NULL, grid_comm, &slots, &win);
+  for (i = 0; i < 4; i++)
+    MPI_Sendrecv(&recv_off[i], 1, MPI_AINT, halo_source[i], 0,
+                 &put_disp[i], 1, MPI_AINT, halo_dest[i], 0, grid_comm, &status);
+
+  do
+  {
+    Async_Refresh(win, stage, send_off, put_disp);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, win);
+    while (1)
+    {
+      if (count < max_iter)
       {
-        fwrite(&iters_sweep_vs_omega[i][j], sizeof(int), 1, f);
+        iter_time = MPI_Wtime();
+        Slow_Down();
+
+        /* the halos as far as the neighbours' puts have arrived */
+        MPI_Win_sync(win);
+        for (i = 0; i < 4; i++)
+          if (halo_source[i] != MPI_PROC_NULL)
+            Halo_Unpack(i, slots + recv_off[i]);
+
+        delta = Do_Step(0);
+        delta2 = Do_Step(1);
+        delta = max(delta, delta2);
+        count++;
+
+        for (i = 0; i < 4; i++)
+          if (halo_dest[i] != MPI_PROC_NULL)
+          {
+            Halo_Pack(i, stage + send_off[i]);
+            MPI_Put(stage + send_off[i], halo_send_bytes[i], MPI_BYTE, halo_dest[i], put_disp[i],
+                    halo_send_bytes[i], MPI_BYTE, win);
+          }
+        /* complete the puts at the targets, so the neighbours see them in this epoch */
+        MPI_Win_flush_all(win);
+        Record_Iteration(MPI_Wtime() - iter_time);
+      }
+
+      if (request == MPI_REQUEST_NULL)
+      {
+        local[0] = delta;
+        local[1] = count;
+        MPI_Iallreduce(local, reduced, 2, MPI_DOUBLE, MPI_MAX, grid_comm, &request);
+      }
+      /* a process out of iterations only waits for the others to notice */
+      if (count >= max_iter)
+      {
+        MPI_Wait(&request, MPI_STATUS_IGNORE);
+        done = 1;
       }
+      else
+        MPI_Test(&request, &done, MPI_STATUS_IGNORE);
+      if (done && (reduced[0] <= precision_goal || reduced[1] >= max_iter))
+        break;
     }
-    fclose(f);
+    MPI_Win_unlock_all(win);
+    if (reduced[1] >= max_iter)
+      break;
+
+    /* one synchronous iteration on the final halos */
+    Async_Refresh(win, stage, send_off, put_disp);
+    for (i = 0; i < 4; i++)
+      if (halo_source[i] != MPI_PROC_NULL)
+        Halo_Unpack(i, slots + recv_off[i]);
+    delta = Do_Step(0);
+    Exchange_Borders();
+    delta2 = Do_Step(1);
+    Exchange_Borders();
+    local[0] = max(delta, delta2);
+    local[1] = ++count;
+    MPI_Allreduce(local, reduced, 2, MPI_DOUBLE, MPI_MAX, grid_comm);
+  } while (reduced[0] > precision_goal && reduced[1] < max_iter);
 
-    generate_fn(fn, "sweep_analysis", "times");
-    FILE *f1 = fopen(fn, "w");
-    if (f1 == NULL)
-      Debug("Error opening sweep file", 1);
+  if (proc_rank == 0)
+    printf("(%i) Asynchronous iteration stopped after at most %.0f iterations\n", proc_rank, reduced[1]);
+
+  MPI_Win_free(&win);
+  free(stage);
+
+  return reduced[0];
+}
+
+/*
+ * Do_Step of the efficient loop on all problems of the batch: the inner loop
+ * runs over a group of BATCH_LANES values of a point and vectorizes, groups
+ * without an iterating problem are skipped. err[b] is the largest change of
+ * problem b, the points of a frozen problem keep their value. Same
+ * arithmetic as Do_Step_Region, so every problem gets the grid a run on its
+ * own would.
+ */
+void Batch_Step(int parity, double *err)
+{
+  int x, y, k, g, b, i, lo, hi, x_parity, n_b = batch_stride;
+  double *p, *p_up, *p_down, new_phi;
+
+  for (b = 0; b < n_b; b++)
+    err[b] = 0.0;
+
+#pragma omp parallel for private(y, k, g, b, lo, hi, x_parity, p, p_up, p_down, new_phi) reduction(max : err[:n_b]) schedule(static)
+  for (x = 1; x < dim[X_DIR] - 1; x++)
+  {
+    x_parity = (x + offset[X_DIR] + offset[Y_DIR] + parity) % 2;
+    for (k = bspan_ptr[x]; k < bspan_ptr[x + 1]; k++)
+    {
+      lo = bspan_lo[k];
+      hi = bspan_hi[k];
+      for (y = lo + (lo + 1 + x_parity) % 2; y < hi; y += 2)
+        for (g = 0; g < n_b; g += BATCH_LANES)
+        {
+          if (!batch_group_active[g / BATCH_LANES])
+            continue;
+          p = &bphi[x][y * n_b + g];
+          p_up = &bphi[x + 1][y * n_b + g];
+          p_down = &bphi[x - 1][y * n_b + g];
+#pragma omp simd private(new_phi)
+          for (b = 0; b < BATCH_LANES; b++)
+          {
+            new_phi = (1 - omega) * p[b] + omega * (p_up[b] + p_down[b] + p[b + n_b] + p[b - n_b]) * 0.25;
+            new_phi = batch_active[g + b] ? new_phi : p[b];
+            err[g + b] = max(err[g + b], fabs(p[b] - new_phi));
+            p[b] = new_phi;
+          }
+        }
+    }
+  }
+
+  /* the sources of other problems of this colour */
+  for (i = 0; i < n_batch_extra; i++)
+  {
+    x = batch_extra[3 * i];
+    y = batch_extra[3 * i + 1];
+    b = batch_extra[3 * i + 2];
+    if ((x + y + offset[X_DIR] + offset[Y_DIR] + parity) % 2 == 1 && batch_active[b])
+    {
+      p = &bphi[x][y * n_b + b];
+      p_up = &bphi[x + 1][y * n_b + b];
+      p_down = &bphi[x - 1][y * n_b + b];
+      new_phi = (1 - omega) * *p + omega * (*p_up + *p_down + p[n_b] + p[-n_b]) * 0.25;
+      err[b] = max(err[b], fabs(*p - new_phi));
+      *p = new_phi;
+    }
+  }
+}
+
+/*
+ * SOR on all problems of -batch at once. The errors of all problems are
+ * reduced together every iteration, a problem that reaches its precision
+ * goal or max iterations is frozen while the others go on. count ends at
+ * the iterations of the slowest problem.
+ */
+double Solve_Batch()
+{
+  int b, n_active = 0;
+  double delta = 0.0;
+  double *err1, *err2, *local_deltas, *global_deltas;
+
+  if ((err1 = malloc(4 * batch_stride * sizeof(double))) == NULL)
+    Debug("Solve_Batch : malloc(err1) failed", 1);
+  err2 = err1 + batch_stride;
+  local_deltas = err2 + batch_stride;
+  global_deltas = local_deltas + batch_stride;
+
+  memcpy(bphi[0], bphi_init, dim[X_DIR] * dim[Y_DIR] * batch_stride * sizeof(double));
+  for (b = 0; b < batch_size; b++)
+  {
+    batch_active[b] = batch_problem[b][1] > 0;
+    n_active += batch_active[b];
+    batch_iters[b] = 0;
+    batch_error[b] = 0.0;
+  }
+
+  while (n_active > 0)
+  {
+    /* groups of frozen problems are skipped */
+    for (b = 0; b < batch_stride / BATCH_LANES; b++)
+      batch_group_active[b] = 0;
+    for (b = 0; b < batch_size; b++)
+      batch_group_active[b / BATCH_LANES] |= batch_active[b];
+
+    if (latency_flag)
+    {
+      latency = 0.0;
+      byte = 0.0;
+    }
+
+    if (timeviter_flag == 1)
+      iter_time = MPI_Wtime();
+
+    Slow_Down();
+
+    Batch_Step(0, err1);
+    halo_colour = colour_halo_flag ? Step_Colour(0) : -1;
+    Exchange_Borders();
+
+    Batch_Step(1, err2);
+    halo_colour = colour_halo_flag ? Step_Colour(1) : -1;
+    Exchange_Borders();
+
+    for (b = 0; b < batch_size; b++)
+      local_deltas[b] = max(err1[b], err2[b]);
+    count++;
+
+    Record_Iteration(MPI_Wtime() - iter_time);
+
+    MPI_Allreduce(local_deltas, global_deltas, batch_size, MPI_DOUBLE, MPI_MAX, grid_comm);
+    for (b = 0; b < batch_size; b++)
+      if (batch_active[b] && (global_deltas[b] <= batch_problem[b][0] || count == batch_problem[b][1]))
+      {
+        batch_active[b] = 0;
+        n_active--;
+        batch_iters[b] = count;
+        batch_error[b] = global_deltas[b];
+      }
+  }
+  halo_colour = -1;
+
+  for (b = 0; b < batch_size; b++)
+  {
+    delta = max(delta, batch_error[b]);
+    if (proc_rank == 0)
+      printf("(%i) Problem %i (%s): Iterations: %i, Error: %.2e\n", proc_rank, b, batch_files[b],
+             batch_iters[b], batch_error[b]);
+  }
+
+  free(err1);
+  return delta;
+}
+
+/*
+ * Multigrid variant of the iteration in Solve, one iteration is one V-cycle
+ * (the first one a full multigrid cycle with -solver fmg). The error is the
+ * largest change of phi in the cycle, like the SOR error.
+ */
+double Solve_Multigrid()
+{
+  int x, y;
+  double delta, global_delta = 2 * precision_goal;
+  double sor_omega = omega;
+  double *old;
+
+  if ((old = malloc(dim[X_DIR] * dim[Y_DIR] * sizeof(double))) == NULL)
+    Debug("Solve_Multigrid : malloc(old) failed", 1);
+
+  /* the smoother is red-black Gauss-Seidel */
+  omega = 1.0;
+
+  while (global_delta > precision_goal && count < max_iter)
+  {
+    if (latency_flag)
+    {
+      latency = 0.0;
+      byte = 0.0;
+    }
+
+    iter_time = MPI_Wtime();
+    memcpy(old, phi[0], dim[X_DIR] * dim[Y_DIR] * sizeof(double));
+
+    if (solver == SOLVER_FMG && count == 0)
+      Full_Multigrid(0);
+    else
+      Vcycle(0);
+
+    delta = 0.0;
+    for (x = 1; x < dim[X_DIR] - 1; x++)
+      for (y = 1; y < dim[Y_DIR] - 1; y++)
+        delta = max(delta, fabs(phi[x][y] - old[x * dim[Y_DIR] + y]));
+
+    count++;
+    Record_Iteration(MPI_Wtime() - iter_time);
+    MPI_Allreduce(&delta, &global_delta, 1, MPI_DOUBLE, MPI_MAX, grid_comm);
+    Record_Errors(&global_delta, count, 1, &global_delta);
+  }
+
+  omega = sor_omega;
+  free(old);
+
+  return global_delta;
+}
+
+void Clean_Up_Multigrid()
+{
+  int l;
+  Level *lv;
+
+  for (l = 0; l < n_levels; l++)
+  {
+    lv = &levels[l];
+    if (!lv->active)
+      continue;
+    MPI_Type_free(&lv->row_type);
+    MPI_Type_free(&lv->col_type);
+    free(lv->r[0]);
+    free(lv->r);
+    /* level 0 shares phi, the sources and the spans */
+    if (l == 0)
+      continue;
+    free(lv->u[0]);
+    free(lv->u);
+    free(lv->b[0]);
+    free(lv->b);
+    free(lv->fixed_x);
+    free(lv->fixed_y);
+    free(lv->fixed_val);
+    free(lv->span_ptr);
+    free(lv->span_lo);
+    free(lv->span_hi);
+  }
+  free(levels);
+  if (proc_rank == 0)
+    free(gather_box);
+  gather_box = NULL;
+}
+
+/* start the omega estimation of a new run from Gauss-Seidel */
+void Reset_Omega()
+{
+  omega = 1.0;
+  omega_adapting = 1;
+  omega_stable = 0;
+  omega_delta = 0.0;
+  omega_ratio = 0.0;
+  rho_jacobi2 = 0.0;
+  chebyshev_step = 0;
+}
+
+/*
+ * omega of the next half-sweep. With -omega chebyshev this is the cyclic
+ * Chebyshev sequence for the current estimate of rho_jacobi2, which tends to
+ * the optimal omega; otherwise omega does not change.
+ */
+double Next_Omega()
+{
+  if (omega_mode == OMEGA_CHEBYSHEV && rho_jacobi2 > 0.0)
+  {
+    if (chebyshev_step == 0)
+      omega = 1.0;
+    else if (chebyshev_step == 1)
+      omega = 1.0 / (1.0 - 0.5 * rho_jacobi2);
+    else
+      omega = 1.0 / (1.0 - 0.25 * rho_jacobi2 * omega);
+    chebyshev_step++;
+  }
+  return omega;
+}
+
+/*
+ * Once global_delta contracts by a settled ratio lambda, lambda is the
+ * spectral radius of red-black SOR with the current omega, which gives the
+ * spectral radius of Jacobi by (lambda + omega - 1)^2 = lambda omega^2 rho^2.
+ * For omega below the optimum this underestimates rho, so omega is raised
+ * to the optimum for the estimate and the estimation starts over, until it
+ * no longer raises omega noticeably.
+ */
+void Adapt_Omega(double global_delta)
+{
+  double ratio, rho2, new_omega;
+
+  if (!omega_adapting)
+    return;
+
+  if (omega_delta > 0.0)
+  {
+    ratio = global_delta / omega_delta;
+    if (ratio < 1.0 && fabs(ratio - omega_ratio) < OMEGA_RATIO_TOL * (1.0 - ratio))
+      omega_stable++;
+    else
+      omega_stable = 0;
+    omega_ratio = ratio;
+  }
+  omega_delta = global_delta;
+
+  if (omega_stable < OMEGA_STABLE_ITERS)
+    return;
+
+  rho2 = (omega_ratio + omega - 1.0) * (omega_ratio + omega - 1.0) / (omega_ratio * omega * omega);
+  if (rho2 >= 1.0)
+    return;
+  new_omega = 2.0 / (1.0 + sqrt(1.0 - rho2));
+
+  omega_stable = 0;
+  omega_delta = 0.0;
+  if (new_omega < omega + OMEGA_MIN_CHANGE)
+  {
+    omega_adapting = 0;
+    return;
+  }
+
+  if (proc_rank == 0)
+    printf("(%i) Iteration %i: rho_jacobi %.6f, omega %.4f\n", proc_rank, count, sqrt(rho2), new_omega);
+  rho_jacobi2 = rho2;
+  chebyshev_step = 0;
+  if (omega_mode == OMEGA_AUTO)
+    omega = new_omega;
+}
+
+/*
+ * The errors of a block of check_every iterations are reduced in one call.
+ * Blocking, the iteration stops at most check_every - 1 iterations after it
+ * has converged. Pipelined, the reduction of a block runs during the next
+ * block, which costs at most one more block. The iteration count and errors
+ * are reported for the iteration at which the goal was reached.
+ */
+void Solve()
+{
+  count = 0;
+  double delta;
+  double global_delta;
+  double delta1, delta2;
+  double *local_deltas, *global_deltas; /* two blocks, the pipelined one and the current */
+  int block = 0;                        /* current block, local_deltas[(block % 2) * check_every ...] */
+  int block_start = 0;                  /* iterations before the current block */
+  int pending_start = 0, pending_n = 0; /* block of the pipelined reduction */
+  int converged = 0;                    /* iteration at which the goal was reached */
+  int restart_count = 0;                /* iteration the run resumed from */
+  int next_checkpoint;
+  double solve_start = MPI_Wtime(), t_iter;
+  MPI_Request check_request = MPI_REQUEST_NULL;
+
+  // Debug("Solve", 0);
+
+  /* give global_delta a higher value then precision_goal */
+  global_delta = 2 * precision_goal;
+  if (telemetry_on)
+  {
+    Telemetry_Reset(&iteration_log);
+    Telemetry_Reset(&error_log);
+  }
+
+  if ((local_deltas = malloc(2 * check_every * sizeof(double))) == NULL)
+    Debug("Solve : malloc(local_deltas) failed", 1);
+  if ((global_deltas = malloc(2 * check_every * sizeof(double))) == NULL)
+    Debug("Solve : malloc(global_deltas) failed", 1);
+
+  n_checkpoints = 0;
+  checkpoint_time = 0.0;
+  checkpoint_slot = 1;
+  if (restart_flag)
+  {
+    restart_count = Read_Checkpoint(&global_delta);
+    block_start = count = restart_count;
+  }
+  next_checkpoint = count + checkpoint_every;
+
+  if (adaptive_fraction > 0.0)
+    Adaptive_Begin();
+
+  if (efficient_loop_flag == CHECKERBOARD_LOOP)
+    Checkerboard_Split();
+
+  if (omega_mode != OMEGA_FIXED)
+    Reset_Omega();
+
+  if (precision == PREC_MIXED)
+    Mixed_Precision_Begin();
+
+  if (active_set_factor > 0.0)
+  {
+    if (telemetry_on)
+      Telemetry_Reset(&tile_log);
+    Active_Begin();
+  }
+
+  /* runs all iterations, the loop below then has nothing left to do */
+  if (deep_halo_flag)
+  {
+    global_delta = Solve_Deep_Halo();
+    converged = count;
+  }
+  else if (solver == SOLVER_ASYNC)
+  {
+    global_delta = Solve_Async();
+    converged = count;
+  }
+  else if (batch_size > 0)
+  {
+    global_delta = Solve_Batch();
+    converged = count;
+  }
+  else if (solver != SOLVER_SOR)
+  {
+    global_delta = Solve_Multigrid();
+    converged = count;
+  }
+
+  while (!converged && count < max_iter)
+  {
+    if (latency_flag)
+    {
+      latency = 0.0;
+      byte = 0.0;
+    }
+
+    if (timeviter_flag == 1)
+      iter_time = MPI_Wtime();
+
+    Slow_Down();
+
+    if (active_set_factor > 0.0)
+      Active_Select();
+
+    if (perf_flag)
+      Perf_Mark();
+
+    if (overlap_flag)
+    {
+      /* the halos of the other colour arrive while the interior is updated */
+      omega = Next_Omega();
+      delta1 = Do_Step_Interior(0);
+      if (perf_flag)
+        Perf_Phase(PERF_STEP);
+      Exchange_Borders_Finish();
+      if (perf_flag)
+        Perf_Phase(PERF_EXCHANGE);
+      delta = Do_Step_Frame(0);
+      delta1 = max(delta1, delta);
+      if (perf_flag)
+        Perf_Phase(PERF_STEP);
+      halo_colour = colour_halo_flag ? Step_Colour(0) : -1;
+      Exchange_Borders_Start();
+      if (perf_flag)
+        Perf_Phase(PERF_EXCHANGE);
+
+      omega = Next_Omega();
+      delta2 = Do_Step_Interior(1);
+      if (perf_flag)
+        Perf_Phase(PERF_STEP);
+      Exchange_Borders_Finish();
+      if (perf_flag)
+        Perf_Phase(PERF_EXCHANGE);
+      delta = Do_Step_Frame(1);
+      delta2 = max(delta2, delta);
+      if (perf_flag)
+        Perf_Phase(PERF_STEP);
+      halo_colour = colour_halo_flag ? Step_Colour(1) : -1;
+      Exchange_Borders_Start();
+      if (perf_flag)
+        Perf_Phase(PERF_EXCHANGE);
+    }
+    else
+    {
+      omega = Next_Omega();
+      delta1 = Do_Step(0);
+      if (perf_flag)
+        Perf_Phase(PERF_STEP);
+      halo_colour = colour_halo_flag ? Step_Colour(0) : -1;
+      Exchange_Borders();
+      if (perf_flag)
+        Perf_Phase(PERF_EXCHANGE);
+
+      omega = Next_Omega();
+      delta2 = Do_Step(1);
+      if (perf_flag)
+        Perf_Phase(PERF_STEP);
+      halo_colour = colour_halo_flag ? Step_Colour(1) : -1;
+      Exchange_Borders();
+      if (perf_flag)
+        Perf_Phase(PERF_EXCHANGE);
+    }
+
+    if (perf_flag)
+      perf_points += (double)(dim[X_DIR] - 2) * (dim[Y_DIR] - 2);
+
+    delta = max(delta1, delta2);
+
+    local_deltas[(block % 2) * check_every + count - block_start] = delta;
+    count++;
+
+    Record_Iteration(MPI_Wtime() - iter_time);
+
+    if (count - block_start == check_every || count == max_iter)
+    {
+      if (check_pipelined_flag)
+      {
+        if (pending_n > 0)
+        {
+          MPI_Wait(&check_request, MPI_STATUS_IGNORE);
+          converged = Record_Errors(&global_deltas[((block + 1) % 2) * check_every],
+                                    pending_start + 1, pending_n, &global_delta);
+        }
+        if (!converged)
+        {
+          pending_start = block_start;
+          pending_n = count - block_start;
+          MPI_Iallreduce(&local_deltas[(block % 2) * check_every], &global_deltas[(block % 2) * check_every],
+                         pending_n, MPI_DOUBLE, MPI_MAX, grid_comm, &check_request);
+        }
+      }
+      else
+      {
+        if (adaptive_fraction > 0.0)
+          Adaptive_Reduce(&local_deltas[(block % 2) * check_every], &global_deltas[(block % 2) * check_every]);
+        else
+          MPI_Allreduce(&local_deltas[(block % 2) * check_every], &global_deltas[(block % 2) * check_every],
+                        count - block_start, MPI_DOUBLE, MPI_MAX, grid_comm);
+        converged = Record_Errors(&global_deltas[(block % 2) * check_every],
+                                  block_start + 1, count - block_start, &global_delta);
+        if (adaptive_fraction > 0.0)
+          converged = Adaptive_Decide(converged, global_delta);
+        if (active_set_factor > 0.0)
+          converged = Active_Decide(converged);
+        if (omega_mode != OMEGA_FIXED)
+          Adapt_Omega(global_delta);
+      }
+      block++;
+      block_start = count;
+
+      if (checkpoint_every && !converged && count < max_iter && count >= next_checkpoint)
+      {
+        Write_Checkpoint(global_delta);
+        next_checkpoint = count + checkpoint_every;
+      }
+
+      if (phi_f != NULL && Mixed_Precision_Done(global_delta))
+      {
+        if (proc_rank == 0)
+          printf("(%i) Continuing in double precision after iteration %i\n", proc_rank, count);
+        Mixed_Precision_End();
+      }
+    }
+  }
+
+  if (phi_f != NULL)
+    Mixed_Precision_End();
+
+  /* the last pipelined reduction, only needed if it decides */
+  if (check_request != MPI_REQUEST_NULL)
+  {
+    MPI_Wait(&check_request, MPI_STATUS_IGNORE);
+    if (!converged)
+      converged = Record_Errors(&global_deltas[((block + 1) % 2) * check_every],
+                                pending_start + 1, pending_n, &global_delta);
+  }
+
+  Exchange_Borders_Finish();
+  halo_colour = -1;
+
+  if (proc_rank == 0 && count > converged)
+    printf("(%i) Convergence detected %i iterations late\n", proc_rank, count - converged);
+  count = converged;
+
+  if (adaptive_fraction > 0.0)
+    Adaptive_End();
+  if (active_set_factor > 0.0)
+    Active_End();
+  free(local_deltas);
+  free(global_deltas);
+
+  if (checkpoint_every)
+  {
+    /* the slowest writer holds up the others at the next reduction */
+    MPI_Allreduce(MPI_IN_PLACE, &checkpoint_time, 1, MPI_DOUBLE, MPI_MAX, grid_comm);
+    if (proc_rank == 0 && n_checkpoints > 0)
+    {
+      t_iter = (MPI_Wtime() - solve_start - checkpoint_time) / max(1, count - restart_count);
+      printf("(%i) %i checkpoints took %.3e s (%.2f%% of the solve), an interval of %i iterations keeps them under 1%%\n",
+             proc_rank, n_checkpoints, checkpoint_time, 100.0 * checkpoint_time / (MPI_Wtime() - solve_start),
+             (int)ceil(100.0 * checkpoint_time / n_checkpoints / t_iter));
+    }
+  }
+  if (converged && (checkpoint_every || restart_flag))
+    Remove_Checkpoints();
+
+  if (efficient_loop_flag == CHECKERBOARD_LOOP)
+    Checkerboard_Merge();
+
+  printf("(%i) Gridsize: %i,  Omega: %.2f, Iterations: %i, Error: %.2e\n", proc_rank, gridsize[X_DIR], omega, count, global_delta);
+  current_iter = count;
+}
+
+/* name of checkpoint slot 0 or 1 of this process for the current run */
+void Checkpoint_Name(char *fn, int slot)
+{
+  sprintf(fn, "%s/ppoisson2_procg=%ix%i_gs=%i_omega=%.4f_sweep=%i_eloop=%i_rank=%i_%i.ckpt", checkpoint_dir,
+          P_grid[X_DIR], P_grid[Y_DIR], gridsize[X_DIR], omega, sweep, efficient_loop_flag, proc_rank, slot);
+}
+
+/*
+ * Write phi with its halos, the iteration count and, on rank 0, the errors
+ * recorded so far to the older slot. The file only gets its name once it is
+ * complete, so a checkpoint is either whole or missing.
+ */
+void Write_Checkpoint(double global_delta)
+{
+  char fn[400], tmp_fn[410];
+  int header[4];
+  long n = 0;
+  double *errors = NULL;
+  double t = MPI_Wtime();
+  FILE *f;
+
+  /* the halos of the last exchange are part of the state */
+  if (overlap_flag)
+    Exchange_Borders_Finish();
+  if (efficient_loop_flag == CHECKERBOARD_LOOP)
+    Checkerboard_Merge();
+  if (proc_rank == 0 && track_errors)
+    errors = Telemetry_Collect(&error_log, &n);
+
+  header[0] = gridsize[X_DIR];
+  header[1] = dim[X_DIR];
+  header[2] = dim[Y_DIR];
+  header[3] = count;
+  checkpoint_slot = 1 - checkpoint_slot;
+  Checkpoint_Name(fn, checkpoint_slot);
+  sprintf(tmp_fn, "%s.tmp", fn);
+  if ((f = fopen(tmp_fn, "wb")) == NULL)
+    Debug("Error opening checkpoint file", 1);
+  fwrite(header, sizeof(int), 4, f);
+  fwrite(&global_delta, sizeof(double), 1, f);
+  fwrite(&n, sizeof(long), 1, f);
+  fwrite(errors, sizeof(double), n, f);
+  if (fwrite(phi[0], sizeof(double), dim[X_DIR] * dim[Y_DIR], f) != (size_t)(dim[X_DIR] * dim[Y_DIR]))
+    Debug("Write_Checkpoint : fwrite failed", 1);
+  fclose(f);
+  if (rename(tmp_fn, fn) != 0)
+    Debug("Write_Checkpoint : rename failed", 1);
+  free(errors);
+
+  n_checkpoints++;
+  checkpoint_time += MPI_Wtime() - t;
+}
+
+/*
+ * Restore the newest checkpoint all processes of grid_comm hold for the
+ * current run and return its iteration count, 0 if there is none.
+ */
+int Read_Checkpoint(double *global_delta)
+{
+  char fn[400];
+  int header[4], slot, ok, best = -1;
+  int counts[2], min_counts[2], max_counts[2];
+  long n, i;
+  double *errors;
+  FILE *f;
+
+  /* a slot counts if it belongs to this grid on every process */
+  for (slot = 0; slot < 2; slot++)
+  {
+    counts[slot] = -1;
+    Checkpoint_Name(fn, slot);
+    if ((f = fopen(fn, "rb")) == NULL)
+      continue;
+    if (fread(header, sizeof(int), 4, f) == 4 && header[0] == gridsize[X_DIR] &&
+        header[1] == dim[X_DIR] && header[2] == dim[Y_DIR])
+      counts[slot] = header[3];
+    fclose(f);
+  }
+  MPI_Allreduce(counts, min_counts, 2, MPI_INT, MPI_MIN, grid_comm);
+  MPI_Allreduce(counts, max_counts, 2, MPI_INT, MPI_MAX, grid_comm);
+  for (slot = 0; slot < 2; slot++)
+    if (min_counts[slot] >= 0 && min_counts[slot] == max_counts[slot] &&
+        (best < 0 || min_counts[slot] > min_counts[best]))
+      best = slot;
+
+  if (best < 0)
+  {
+    if (proc_rank == 0)
+      printf("(%i) No checkpoint found, starting from the initial grid\n", proc_rank);
+    return 0;
+  }
+
+  Checkpoint_Name(fn, best);
+  if ((f = fopen(fn, "rb")) == NULL)
+    Debug("Error opening checkpoint file", 1);
+  ok = fread(header, sizeof(int), 4, f) == 4;
+  ok &= fread(global_delta, sizeof(double), 1, f) == 1;
+  ok &= fread(&n, sizeof(long), 1, f) == 1;
+  if ((errors = malloc((n + 1) * sizeof(double))) == NULL)
+    Debug("Read_Checkpoint : malloc(errors) failed", 1);
+  ok &= (long)fread(errors, sizeof(double), n, f) == n;
+  ok &= fread(phi[0], sizeof(double), dim[X_DIR] * dim[Y_DIR], f) == (size_t)(dim[X_DIR] * dim[Y_DIR]);
+  fclose(f);
+  if (!ok)
+    Debug("Read_Checkpoint : checkpoint file is truncated", 1);
+
+  /* the convergence history continues where it was cut off */
+  if (proc_rank == 0 && track_errors)
+    for (i = 0; i < n; i++)
+      Telemetry_Append(&error_log, &errors[i]);
+  free(errors);
+
+  checkpoint_slot = best;
+  if (proc_rank == 0)
+    printf("(%i) Restarting after iteration %i\n", proc_rank, header[3]);
+  return header[3];
+}
+
+/* a finished run leaves no checkpoint to resume from */
+void Remove_Checkpoints()
+{
+  char fn[400];
+  int slot;
+
+  for (slot = 0; slot < 2; slot++)
+  {
+    Checkpoint_Name(fn, slot);
+    remove(fn);
+  }
+}
+
+/*
+ * All processes write their part of phi into one gridsize[X_DIR] x
+ * gridsize[Y_DIR] file of doubles (x major) with a single collective call.
+ * Local point x lands at global index offset[X_DIR] + x; the process at the
+ * start of a dimension also writes its boundary row 0, the one at the end
+ * leaves out its last row, which lies past the end of the file, so every
+ * element of the file is written exactly once. With -batch every problem of
+ * bphi goes to a file of its own.
+ */
+void Write_Grid()
+{
+  int i, b, sizes[3], subsizes[3], starts[3], file_starts[2];
+  char fn[200], type[40];
+  MPI_Datatype mem_type, file_type;
+  MPI_File fh;
+
+  for (i = X_DIR; i <= Y_DIR; i++)
+  {
+    starts[i] = (proc_coord[i] == 0) ? 0 : 1;
+    subsizes[i] = ((proc_coord[i] == P_grid[i] - 1) ? dim[i] - 2 : dim[i] - 1) - starts[i];
+    file_starts[i] = offset[i] + starts[i];
+  }
+
+  sizes[X_DIR] = dim[X_DIR];
+  sizes[Y_DIR] = dim[Y_DIR];
+  sizes[2] = batch_size > 0 ? batch_stride : 1;
+  subsizes[2] = 1;
+  MPI_Type_create_subarray(2, gridsize, subsizes, file_starts, MPI_ORDER_C, MPI_DOUBLE, &file_type);
+  MPI_Type_commit(&file_type);
+
+  for (b = 0; b < max(batch_size, 1); b++)
+  {
+    starts[2] = b;
+    MPI_Type_create_subarray(3, sizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, &mem_type);
+    MPI_Type_commit(&mem_type);
+
+    /* all processes have to open the file under the name rank 0 chose */
+    if (batch_size > 0)
+      sprintf(type, "problem=%i_phi", b);
+    else
+      strcpy(type, "phi");
+    if (proc_rank == 0)
+      generate_fn(fn, "output", type);
+    MPI_Bcast(fn, 200, MPI_CHAR, 0, grid_comm);
+
+    if (MPI_File_open(grid_comm, fn, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+      Debug("Write_Grid : MPI_File_open failed", 1);
+    MPI_File_set_size(fh, 0);
+    MPI_File_set_view(fh, 0, MPI_DOUBLE, file_type, "native", MPI_INFO_NULL);
+    if (MPI_File_write_all(fh, batch_size > 0 ? bphi[0] : phi[0], 1, mem_type, &status) != MPI_SUCCESS)
+      Debug("Write_Grid : MPI_File_write_all failed", 1);
+    MPI_File_close(&fh);
+
+    MPI_Type_free(&mem_type);
+  }
+
+  MPI_Type_free(&file_type);
+}
+
+void Benchmark()
+{
+  double ***benchmark; /* 3D array holding benchmark results shape 2 x #processors x #omegas*/
+  int benchmark_size, i, j, p;
+  int *threads;        /* OpenMP threads of every process */
+  // Debug("Benchmark", 0);
+
+  if ((threads = malloc(P * sizeof(int))) == NULL)
+    Debug("Benchmark : malloc(threads) failed", 1);
+  MPI_Gather(&n_threads, 1, MPI_INT, threads, 1, MPI_INT, 0, grid_comm);
+
+  benchmark_size = 2 * P * omega_length;
+  if (proc_rank == 0)
+  {
+    // Allocate memory for the pointers to the rows
+    benchmark = malloc(2 * sizeof(double **));
+    if (benchmark == NULL)
+      Debug("Benchmark : malloc(benchmark) failed", 1);
+    if ((benchmark[0] = malloc(P * sizeof(double *))) == NULL)
+      Debug("Benchmark : malloc(benchmark[0]) failed", 1);
+    if ((benchmark[1] = malloc(P * sizeof(double *))) == NULL)
+      Debug("Benchmark : malloc(benchmark[1]) failed", 1);
+    for (i = 0; i < 2; i++)
+    {
+      for (p = 0; p < P; p++)
+      {
+        if ((benchmark[i][p] = malloc(omega_length * sizeof(double))) == NULL)
+          Debug("Benchmark : malloc(benchmark[i][p]) failed", 1);
+      }
+    }
+
+    // Assign values to the elements
+    for (i = 0; i < 2; i++)
+    {
+      for (p = 0; p < P; p++)
+      {
+        for (j = 0; j < omega_length; j++)
+        {
+          benchmark[i][p][j] = 0.0;
+        }
+      }
+    }
+
+    for (j = 0; j < omega_length; j++)
+    {
+      benchmark[0][0][j] = wtimes[j];
+      benchmark[1][0][j] = cpu_util[j];
+    }
+  }
+
+  // gather times
+  if (proc_rank != 0)
+  {
+    MPI_Send(wtimes, omega_length, MPI_DOUBLE, 0, 0, grid_comm);
+  }
+  else
+  {
+    for (p = 1; p < P; p++)
+    {
+      MPI_Recv(benchmark[0][p], omega_length, MPI_DOUBLE, p, 0, grid_comm, &status);
+    }
+  }
+  // gather times using MPI_Gather
+  // MPI_Gather(&wtimes[0], omega_length, MPI_DOUBLE, &benchmark[0][proc_rank][0], omega_length, MPI_DOUBLE, 0, grid_comm);
+  MPI_Barrier(grid_comm);
+
+  // gather cpu util
+  if (proc_rank != 0)
+  {
+    MPI_Send(cpu_util, omega_length, MPI_DOUBLE, 0, 0, grid_comm);
+  }
+  else
+  {
+    for (p = 1; p < P; p++)
+    {
+      MPI_Recv(benchmark[1][p], omega_length, MPI_DOUBLE, p, 0, grid_comm, &status);
+    }
+  }
+  // MPI_Gather(&cpu_util[0], omega_length, MPI_DOUBLE, &benchmark[1][proc_rank][0], omega_length, MPI_DOUBLE, 0, grid_comm);
+  MPI_Barrier(grid_comm);
+
+  if (proc_rank == 0)
+  {
+    // char fn_template[] = "ppoisson_times/procg=%ix%i__gs=%ix%i_wl=%3.2f_wh=%3.2f_nomega=%i_times.dat";
+    char fn[200];
+    generate_fn(fn, "ppoisson_times", "times");
+    FILE *f = fopen(fn, "w");
+    if (f == NULL)
+      Debug("Error opening benchmark file", 1);
+
+    for (i = 0; i < 2; i++)
+    {
+      for (p = 0; p < P; p++)
+      {
+        for (j = 0; j < omega_length; j++)
+        {
+          fwrite(&benchmark[i][p][j], sizeof(double), 1, f);
+        }
+      }
+    }
+    fclose(f);
+
+    //  save omega values to file
+    generate_fn(fn, "ppoisson_times", "omegas");
+    FILE *f2 = fopen(fn, "w");
+    if (f2 == NULL)
+      Debug("Error opening benchmark file", 1);
+
+    for (i = 0; i < omega_length; i++)
+    {
+      fwrite(&omegas[i], sizeof(double), 1, f2);
+    }
+
+    fclose(f2);
+
+    generate_fn(fn, "ppoisson_times", "iters");
+    FILE *f3 = fopen(fn, "w");
+    if (f3 == NULL)
+      Debug("Error opening benchmark file", 1);
+
+    for (i = 0; i < omega_length; i++)
+    {
+      fwrite(&iters[i], sizeof(int), 1, f3);
+    }
+
+    fclose(f3);
+
+    // save threads per process to file
+    generate_fn(fn, "ppoisson_times", "threads");
+    FILE *f4 = fopen(fn, "w");
+    if (f4 == NULL)
+      Debug("Error opening benchmark file", 1);
+
+    fwrite(threads, sizeof(int), P, f4);
+
+    fclose(f4);
+  }
+  free(threads);
+
+  if (perf_flag)
+    Perf_Report();
+}
+
+/* open the counters of every thread, each thread opens its own */
+void Perf_Setup()
+{
+  int n_open = 0;
+
+  perf_threads = max_threads;
+  if ((perf_fd = malloc(perf_threads * PERF_N_EVENTS * sizeof(int))) == NULL)
+    Debug("Perf_Setup : malloc(perf_fd) failed", 1);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(perf_threads) reduction(+ : n_open)
+  n_open = Perf_Open(&perf_fd[omp_get_thread_num() * PERF_N_EVENTS]);
+#else
+  n_open = Perf_Open(perf_fd);
+#endif
+  if (n_open < perf_threads * PERF_N_EVENTS)
+    printf("(%i) Only %i of %i hardware counters are available, the others read 0\n", proc_rank, n_open,
+           perf_threads * PERF_N_EVENTS);
+  memset(perf_counts, 0, sizeof(perf_counts));
+  memset(perf_time, 0, sizeof(perf_time));
+  perf_points = 0.0;
+}
+
+/* start a new phase */
+void Perf_Mark()
+{
+  memset(perf_mark, 0, sizeof(perf_mark));
+  Perf_Read(perf_fd, perf_threads, perf_mark);
+  perf_mark_time = MPI_Wtime();
+}
+
+/* add the events since the last mark to phase and start a new one */
+void Perf_Phase(int phase)
+{
+  long long now[PERF_N_EVENTS] = {0};
+  double t = MPI_Wtime();
+  int k;
+
+  Perf_Read(perf_fd, perf_threads, now);
+  for (k = 0; k < PERF_N_EVENTS; k++)
+  {
+    perf_counts[phase][k] += now[k] - perf_mark[k];
+    perf_mark[k] = now[k];
+  }
+  perf_time[phase] += t - perf_mark_time;
+  perf_mark_time = t;
+}
+
+/*
+ * Write the counters of every process to the "counters" file next to the
+ * times: per process and per phase the PERF_N_EVENTS counts, the seconds,
+ * the GFLOP/s of the updated points and the memory bytes (last level cache
+ * misses times the line size) per updated point. The counts start again.
+ */
+void Perf_Report()
+{
+  int i, k;
+  double record[N_PERF_PHASES * (PERF_N_EVENTS + 3)], *all = NULL, *r;
+  char fn[200];
+  FILE *f;
+
+  for (i = 0; i < N_PERF_PHASES; i++)
+  {
+    r = &record[i * (PERF_N_EVENTS + 3)];
+    for (k = 0; k < PERF_N_EVENTS; k++)
+      r[k] = perf_counts[i][k];
+    r[PERF_N_EVENTS] = perf_time[i];
+    r[PERF_N_EVENTS + 1] = (i == PERF_STEP && perf_time[i] > 0.0)
+                               ? SOR_FLOPS_PER_POINT * perf_points / perf_time[i] * 1e-9
+                               : 0.0;
+    r[PERF_N_EVENTS + 2] = perf_points > 0.0 ? PERF_CACHE_LINE * r[3] / perf_points : 0.0;
+  }
+
+  if (proc_rank == 0 && (all = malloc(P * sizeof(record))) == NULL)
+    Debug("Perf_Report : malloc(all) failed", 1);
+  MPI_Gather(record, N_PERF_PHASES * (PERF_N_EVENTS + 3), MPI_DOUBLE,
+             all, N_PERF_PHASES * (PERF_N_EVENTS + 3), MPI_DOUBLE, 0, grid_comm);
+
+  if (proc_rank == 0)
+  {
+    for (i = 0; i < N_PERF_PHASES; i++)
+    {
+      r = &record[i * (PERF_N_EVENTS + 3)];
+      printf("(%i) %-8s %.3e s, IPC %.2f, LLC miss rate %.3f, %.2f GFLOP/s, %.1f bytes/point\n", proc_rank,
+             i == PERF_STEP ? "Do_Step" : "Exchange", r[PERF_N_EVENTS], r[0] > 0 ? r[1] / r[0] : 0.0,
+             r[2] > 0 ? r[3] / r[2] : 0.0, r[PERF_N_EVENTS + 1], r[PERF_N_EVENTS + 2]);
+    }
+
+    generate_fn(fn, "ppoisson_times", "counters");
+    if ((f = fopen(fn, "w")) == NULL)
+      Debug("Error opening benchmark file", 1);
+    fwrite(all, sizeof(record), P, f);
+    fclose(f);
+    free(all);
+  }
+
+  memset(perf_counts, 0, sizeof(perf_counts));
+  memset(perf_time, 0, sizeof(perf_time));
+  perf_points = 0.0;
+}
+
+void Telemetry_Init(Telemetry *t, int width)
+{
+  int k;
+
+  t->width = width;
+  for (k = 0; k < TELEMETRY_POOL; k++)
+  {
+    if ((t->chunk[k] = malloc(TELEMETRY_CHUNK * width * sizeof(double))) == NULL)
+      Debug("Telemetry_Init : malloc(chunk) failed", 1);
+    t->full[k] = 0;
+  }
+  t->cur = 0;
+  t->fill = 0;
+  t->n_flushed = 0;
+  if ((t->spill = tmpfile()) == NULL)
+    Debug("Telemetry_Init : tmpfile() failed", 1);
+}
+
+/*
+ * Body of the flush thread: writes the queued chunks to their spill files
+ * in the order they filled and releases them for reuse.
+ */
+void *Telemetry_Flush(void *arg)
+{
+  Telemetry *t;
+  int k;
+
+  pthread_mutex_lock(&telemetry_lock);
+  while (1)
+  {
+    while (telemetry_queued == 0 && !telemetry_stop)
+      pthread_cond_wait(&telemetry_cond, &telemetry_lock);
+    if (telemetry_queued == 0)
+      break;
+
+    t = telemetry_queue[telemetry_head];
+    k = telemetry_queue_chunk[telemetry_head];
+    pthread_mutex_unlock(&telemetry_lock);
+
+    if (fwrite(t->chunk[k], sizeof(double) * t->width, TELEMETRY_CHUNK, t->spill) != TELEMETRY_CHUNK)
+      Debug("Telemetry_Flush : fwrite failed", 1);
+
+    pthread_mutex_lock(&telemetry_lock);
+    telemetry_head = (telemetry_head + 1) % (TELEMETRY_STREAMS * TELEMETRY_POOL);
+    telemetry_queued--;
+    t->full[k] = 0;
+    pthread_cond_broadcast(&telemetry_cond);
+  }
+  pthread_mutex_unlock(&telemetry_lock);
+
+  return arg;
+}
+
+void Telemetry_Start()
+{
+  Telemetry_Init(&iteration_log, 3);
+  Telemetry_Init(&error_log, 1);
+  Telemetry_Init(&tile_log, 1);
+  telemetry_stop = 0;
+  if (pthread_create(&telemetry_thread, NULL, Telemetry_Flush, NULL) != 0)
+    Debug("Telemetry_Start : pthread_create failed", 1);
+  telemetry_on = 1;
+}
+
+/*
+ * Copy a record into the current chunk. A full chunk is handed to the
+ * flush thread, the solver only waits when every chunk of the stream is
+ * still queued.
+ */
+void Telemetry_Append(Telemetry *t, double *record)
+{
+  int tail;
+
+  memcpy(t->chunk[t->cur] + t->fill * t->width, record, t->width * sizeof(double));
+  if (++t->fill < TELEMETRY_CHUNK)
+    return;
+
+  pthread_mutex_lock(&telemetry_lock);
+  tail = (telemetry_head + telemetry_queued) % (TELEMETRY_STREAMS * TELEMETRY_POOL);
+  telemetry_queue[tail] = t;
+  telemetry_queue_chunk[tail] = t->cur;
+  telemetry_queued++;
+  t->full[t->cur] = 1;
+  pthread_cond_broadcast(&telemetry_cond);
+
+  t->cur = (t->cur + 1) % TELEMETRY_POOL;
+  while (t->full[t->cur])
+    pthread_cond_wait(&telemetry_cond, &telemetry_lock);
+  pthread_mutex_unlock(&telemetry_lock);
+
+  t->n_flushed += TELEMETRY_CHUNK;
+  t->fill = 0;
+}
+
+/* wait until the flush thread has written every queued chunk of t */
+void Telemetry_Sync(Telemetry *t)
+{
+  int k, busy;
+
+  pthread_mutex_lock(&telemetry_lock);
+  do
+  {
+    busy = 0;
+    for (k = 0; k < TELEMETRY_POOL; k++)
+      busy |= t->full[k];
+    if (busy)
+      pthread_cond_wait(&telemetry_cond, &telemetry_lock);
+  } while (busy);
+  pthread_mutex_unlock(&telemetry_lock);
+}
+
+/* drop the records of the previous run */
+void Telemetry_Reset(Telemetry *t)
+{
+  Telemetry_Sync(t);
+  rewind(t->spill);
+  t->n_flushed = 0;
+  t->fill = 0;
+}
+
+/*
+ * Return all records of the current run in one array, *n is set to the
+ * number of records. The stream stays valid for further appends.
+ */
+double *Telemetry_Collect(Telemetry *t, long *n)
+{
+  double *out;
+  long total;
+
+  Telemetry_Sync(t);
+  total = t->n_flushed + t->fill;
+  if ((out = malloc((total + 1) * t->width * sizeof(double))) == NULL)
+    Debug("Telemetry_Collect : malloc(out) failed", 1);
+
+  fflush(t->spill);
+  rewind(t->spill);
+  if ((long)fread(out, sizeof(double) * t->width, t->n_flushed, t->spill) != t->n_flushed)
+    Debug("Telemetry_Collect : fread failed", 1);
+  fseek(t->spill, t->n_flushed * t->width * sizeof(double), SEEK_SET);
+  memcpy(out + t->n_flushed * t->width, t->chunk[t->cur], t->fill * t->width * sizeof(double));
+
+  *n = total;
+  return out;
+}
+
+void Telemetry_Stop()
+{
+  int k;
+
+  pthread_mutex_lock(&telemetry_lock);
+  telemetry_stop = 1;
+  pthread_cond_broadcast(&telemetry_cond);
+  pthread_mutex_unlock(&telemetry_lock);
+  pthread_join(telemetry_thread, NULL);
+
+  for (k = 0; k < TELEMETRY_POOL; k++)
+  {
+    free(iteration_log.chunk[k]);
+    free(error_log.chunk[k]);
+    free(tile_log.chunk[k]);
+  }
+  fclose(iteration_log.spill);
+  fclose(error_log.spill);
+  fclose(tile_log.spill);
+  telemetry_on = 0;
+}
+
+void Error_Analysis()
+{
+  // Debug("Error_Analysis", 0);
+  // char fn_template[] = "error_analysis/procg=%ix%i__gs=%ix%i_omega=%3.2f.dat";
+  char fn[200];
+  double start = 2 * precision_goal;
+  double *errors;
+  long n;
+  generate_fn(fn, "error_analysis", "");
+  // sprintf(fn, fn_template, P_grid[X_DIR], P_grid[Y_DIR], gridsize[X_DIR], gridsize[Y_DIR], omega);
+  if (proc_rank == 0)
+  {
+    FILE *f = fopen(fn, "w");
+    if (f == NULL)
+      Debug("Error opening error file", 1);
+
+    /* the initial error, then that of every iteration but the last */
+    errors = Telemetry_Collect(&error_log, &n);
+    fwrite(&start, sizeof(double), 1, f);
+    for (int i = 0; i < count - 1 && i < n; i++)
+    {
+      fwrite(&errors[i], sizeof(double), 1, f);
+    }
+    fclose(f);
+    free(errors);
+  }
+}
+
+void Sweep_Analysis()
+{
+  int sweep_vs_omega_size = omega_length * sweep_length;
+  // Debug("Sweep_Analysis", 0);
+  if (proc_rank == 0)
+  {
+    char fn[200];
+    generate_fn(fn, "sweep_analysis", "iters");
+    FILE *f = fopen(fn, "w");
+    if (f == NULL)
+      Debug("Error opening sweep file", 1);
+
+    for (int i = 0; i < sweep_length; i++)
+    {
+      for (int j = 0; j < omega_length; j++)
+      {
+        fwrite(&iters_sweep_vs_omega[i][j], sizeof(int), 1, f);
+      }
+    }
+    fclose(f);
+
+    generate_fn(fn, "sweep_analysis", "times");
+    FILE *f1 = fopen(fn, "w");
+    if (f1 == NULL)
+      Debug("Error opening sweep file", 1);
+
+    for (int i = 0; i < sweep_length; i++)
+    {
+      for (int j = 0; j < omega_length; j++)
+      {
+        fwrite(&times_sweep_vs_omega[i][j], sizeof(double), 1, f1);
+      }
+    }
+    fclose(f1);
+
+    generate_fn(fn, "sweep_analysis", "sweeps");
+    FILE *f2 = fopen(fn, "w");
+    if (f2 == NULL)
+      Debug("Error opening sweep file", 1);
+
+    for (int i = 0; i < sweep_length; i++)
+    {
+      fwrite(&sweeps[i], sizeof(int), 1, f2);
+    }
+    fclose(f2);
+
+    /* -adaptive-exchange runs a single sweep, one value per omega */
+    if (adaptive_fraction > 0.0)
+    {
+      generate_fn(fn, "sweep_analysis", "messages");
+      FILE *f3 = fopen(fn, "w");
+      if (f3 == NULL)
+        Debug("Error opening sweep file", 1);
+      fwrite(messages_saved, sizeof(long), omega_length, f3);
+      fclose(f3);
+
+      generate_fn(fn, "sweep_analysis", "stale");
+      FILE *f4 = fopen(fn, "w");
+      if (f4 == NULL)
+        Debug("Error opening sweep file", 1);
+      fwrite(stale_iters, sizeof(int), omega_length, f4);
+      fclose(f4);
+    }
+
+  }
+}
+
+void Latency_Analysis()
+{
+  // Debug("Latency_Analysis", 0);
+  double ***out; // holds latencies, bytes per process shape =  2 x P x latency_length
+  double *latencies, *bytes, *records;
+  int out_size, i, j, p, latency_length;
+  long n;
+
+  records = Telemetry_Collect(&iteration_log, &n);
+  latency_length = n;
+  if ((latencies = malloc((n + 1) * sizeof(double))) == NULL)
+    Debug("Latency_Analysis : malloc(latencies) failed", 1);
+  if ((bytes = malloc((n + 1) * sizeof(double))) == NULL)
+    Debug("Latency_Analysis : malloc(bytes) failed", 1);
+  for (j = 0; j < latency_length; j++)
+  {
+    latencies[j] = records[3 * j + 1];
+    bytes[j] = records[3 * j + 2];
+  }
+  free(records);
+
+  if (proc_rank == 0)
+  {
+
+    out_size = 2 * P * latency_length;
+    // Allocate memory for the pointers to the rows
+    if ((out = malloc(2 * sizeof(double **))) == NULL)
+      Debug("Latency_Analysis : malloc(out) failed", 1);
+    if ((out[0] = malloc(P * sizeof(double *))) == NULL)
+      Debug("Latency_Analysis : malloc(out[0]) failed", 1);
+    if ((out[1] = malloc(P * sizeof(double *))) == NULL)
+      Debug("Latency_Analysis : malloc(out[1]) failed", 1);
+    for (i = 0; i < 2; i++)
+    {
+      for (p = 0; p < P; p++)
+      {
+        if ((out[i][p] = malloc(latency_length * sizeof(double))) == NULL)
+          Debug("Latency_Analysis : malloc(out[i][p]) failed", 1);
+      }
+    }
+
+    for (j = 0; j < latency_length; j++)
+    {
+      out[0][0][j] = latencies[j];
+      out[1][0][j] = bytes[j];
+    }
+  }
+
+  MPI_Barrier(grid_comm);
+
+  // gather latencies
+  if (proc_rank != 0)
+  {
+    MPI_Send(latencies, latency_length, MPI_DOUBLE, 0, 0, grid_comm);
+  }
+  else
+  {
+    for (p = 1; p < P; p++)
+    {
+      MPI_Recv(&out[0][p][0], latency_length, MPI_DOUBLE, p, 0, grid_comm, &status);
+    }
+  }
+
+  MPI_Barrier(grid_comm);
+
+  // gather bytes
+  if (proc_rank != 0)
+  {
+    MPI_Send(bytes, latency_length, MPI_DOUBLE, 0, 0, grid_comm);
+  }
+  else
+  {
+    for (p = 1; p < P; p++)
+    {
+      MPI_Recv(&out[1][p][0], latency_length, MPI_DOUBLE, p, 0, grid_comm, &status);
+    }
+  }
+
+  MPI_Barrier(grid_comm);
+
+  if (proc_rank == 0)
+  {
+    char fn[200];
+    generate_fn(fn, "latency_analysis", "");
+    FILE *f = fopen(fn, "w");
+    if (f == NULL)
+      Debug("Error opening latency file", 1);
+
+    for (i = 0; i < 2; i++)
+    {
+      for (p = 0; p < P; p++)
+      {
+        for (j = 0; j < latency_length; j++)
+        {
+          fwrite(&out[i][p][j], sizeof(double), 1, f);
+        }
+      }
+    }
+    fclose(f);
+
+    /* seconds per exchange of every halo backend, in the order of halo_names */
+    if (halo_auto_flag)
+    {
+      generate_fn(fn, "latency_analysis", "halo");
+      if ((f = fopen(fn, "w")) == NULL)
+        Debug("Error opening halo calibration file", 1);
+      fwrite(halo_times, sizeof(double), N_HALO_ENGINES, f);
+      fclose(f);
+    }
+    // free memory
+    // for (i = 0; i < 2; i++)
+    // {
+    //   for (p = 0; p < P; p++)
+    //   {
+    //     free(out[i][p]);
+    //   }
+    //   free(out[i]);
+    // }
+  }
+  free(latencies);
+  free(bytes);
+}
+
+/* tiles updated by all processes in every iteration of the last run */
+void Tile_Analysis()
+{
+  char fn[200];
+  double *tiles;
+  long n;
+  FILE *f;
+
+  tiles = Telemetry_Collect(&tile_log, &n);
+  MPI_Reduce(proc_rank == 0 ? MPI_IN_PLACE : tiles, tiles, n, MPI_DOUBLE, MPI_SUM, 0, grid_comm);
+  if (proc_rank == 0)
+  {
+    generate_fn(fn, "timeviters", "tiles");
+    if ((f = fopen(fn, "w")) == NULL)
+      Debug("Error opening tiles file", 1);
+    fwrite(tiles, sizeof(double), n, f);
+    fclose(f);
+  }
+  free(tiles);
+}
+
+void timeVIteration()
+{
+  char fn[200];
+  double start = 0.0;
+  double *records;
+  long n;
+
+  if (proc_rank == 0)
+  {
+    generate_fn(fn, "timeviters", "");
+    FILE *f = fopen(fn, "w");
+    if (f == NULL)
+      Debug("Error opening timeviter file", 1);
+
+    /* wall times of the last run, after the start at 0 */
+    records = Telemetry_Collect(&iteration_log, &n);
+    fwrite(&start, sizeof(double), 1, f);
+    for (long i = 0; i < n; i++)
+    {
+      fwrite(&records[3 * i], sizeof(double), 1, f);
+    }
+    fclose(f);
+    free(records);
+  }
+}
+
+void Clean_Up_Problemdata()
+{
+  // Debug("Clean_Up", 0);
+
+  Halo_Engine_Reset();
+  Free_Colour_Table();
+  setup_gridsize = -1;
+
+  if (phi_shared)
+  {
+    MPI_Win_unlock_all(phi_win);
+    MPI_Win_free(&phi_win);
+    phi_shared = 0;
+  }
+  else
+    free(phi[0]);
+  free(phi);
+  free(phi_init);
+  free(span_ptr);
+  free(span_lo);
+  free(span_hi);
+  free(src_x);
+  free(src_y);
+  free(src_val);
+  if (efficient_loop_flag == CHECKERBOARD_LOOP)
+  {
+    for (int i = 0; i < 4; i++)
+    {
+      MPI_Type_free(&halo_send_type[i]);
+      MPI_Type_free(&halo_recv_type[i]);
+    }
+    for (int c = 0; c < 2; c++)
+      free(cb_phi[c]);
+  }
+  else
+  {
+    MPI_Type_free(&border_type[X_DIR]);
+    MPI_Type_free(&border_type[Y_DIR]);
+  }
+  if (solver == SOLVER_VCYCLE || solver == SOLVER_FMG)
+    Clean_Up_Multigrid();
+  if (batch_size > 0)
+  {
+    MPI_Type_free(&batch_point_type);
+    free(bphi[0]);
+    free(bphi);
+    free(bphi_init);
+    free(bspan_ptr);
+    free(bspan_lo);
+    free(bspan_hi);
+    free(batch_extra);
+  }
+  if (deep_halo_flag)
+  {
+    free(dh_phi[0]);
+    free(dh_phi);
+    free(dh_span_ptr);
+    free(dh_span_lo);
+    free(dh_span_hi);
+  }
+  // if (latency_flag)
+  // {
+  //   free(latencies);
+  //   free(bytes);
+  // }
+}
+
+void Clean_Up_Metadata()
+{
+  // Debug("Clean_Up_Metadata", 0);
+
+  free(omegas);
+  free(gridsizes);
+  free(iters);
+  free(wtimes);
+  free(cpu_util);
+  free(sweeps);
+  // for (int i = 0; i < sweep_length; i++)
+  // {
+  //   free(iters_sweep_vs_omega[i]);
+  // }
+  // free(iters_sweep_vs_omega);
+  // if (latency_flag)
+  // {
+  //   free(latencies);
+  //   free(bytes);
+  // }
+}
+
+void Setup_MPI_Datatypes()
+{
+  int i;
+  MPI_Datatype type;
+
+  // Debug("Setup_MPI_Datatypes", 0);
+
+  /* neighbours of the halo exchange table */
+  halo_dest[TO_TOP] = proc_top;
+  halo_source[TO_TOP] = proc_bottom;
+  halo_dest[TO_BOTTOM] = proc_bottom;
+  halo_source[TO_BOTTOM] = proc_top;
+  halo_dest[TO_LEFT] = proc_left;
+  halo_source[TO_LEFT] = proc_right;
+  halo_dest[TO_RIGHT] = proc_right;
+  halo_source[TO_RIGHT] = proc_left;
+
+  if (efficient_loop_flag == CHECKERBOARD_LOOP)
+    Setup_Checkerboard_Datatypes();
+  else if (deep_halo_flag)
+    Setup_Deep_Halo_Datatypes();
+  else if (batch_size > 0)
+  {
+    /* the borders of bphi, a point is the values of all problems without the
+       padding, which the pack backend leaves to MPI_Pack */
+    MPI_Type_contiguous(batch_size, MPI_DOUBLE, &type);
+    MPI_Type_create_resized(type, 0, batch_stride * sizeof(double), &batch_point_type);
+    MPI_Type_commit(&batch_point_type);
+    MPI_Type_free(&type);
+    MPI_Type_vector(dim[X_DIR] - 2, 1, dim[Y_DIR], batch_point_type, &border_type[Y_DIR]);
+    MPI_Type_commit(&border_type[Y_DIR]);
+    MPI_Type_vector(dim[Y_DIR] - 2, 1, 1, batch_point_type, &border_type[X_DIR]);
+    MPI_Type_commit(&border_type[X_DIR]);
+
+    Setup_Halo_Table((char *)bphi[0], batch_stride * sizeof(double), border_type);
+    for (i = 0; i < 4; i++)
+      halo_blocks[i] = 0;
+  }
+  else
+  {
+    /* Datatype for vertical data exchange (Y_DIR) */
+    MPI_Type_vector(dim[X_DIR] - 2, 1, dim[Y_DIR],
+                    MPI_DOUBLE, &border_type[Y_DIR]);
+    MPI_Type_commit(&border_type[Y_DIR]);
+
+    /* Datatype for horizontal data exchange (X_DIR) */
+    MPI_Type_vector(dim[Y_DIR] - 2, 1, 1,
+                    MPI_DOUBLE, &border_type[X_DIR]);
+    MPI_Type_commit(&border_type[X_DIR]);
+
+    Setup_Halo_Table((char *)phi[0], sizeof(double), border_type);
+  }
+
+  if (halo_auto_flag)
+    Calibrate_Halo();
+}
+
+/*
+ * Point the halo exchange table at a dim[X_DIR] x dim[Y_DIR] field with
+ * elements of size bytes, types are its vertical and horizontal borders.
+ */
+void Setup_Halo_Table(char *field, int size, MPI_Datatype *types)
+{
+  int i, n_y = dim[Y_DIR];
+
+  Halo_Engine_Reset();
+  halo_elem_size = size;
+  for (i = TO_TOP; i <= TO_BOTTOM; i++)
+  {
+    halo_blocks[i] = dim[X_DIR] - 2;
+    halo_blocklen[i] = 1;
+    halo_stride[i] = n_y;
+  }
+  for (i = TO_LEFT; i <= TO_RIGHT; i++)
+  {
+    halo_blocks[i] = 1;
+    halo_blocklen[i] = n_y - 2;
+    halo_stride[i] = 0;
+  }
+
+  halo_send_buf[TO_TOP] = field + (1 * n_y + 1) * size;
+  halo_recv_buf[TO_TOP] = field + (1 * n_y + n_y - 1) * size;
+  halo_send_buf[TO_BOTTOM] = field + (1 * n_y + n_y - 2) * size;
+  halo_recv_buf[TO_BOTTOM] = field + (1 * n_y + 0) * size;
+  halo_send_type[TO_TOP] = halo_recv_type[TO_TOP] = types[Y_DIR];
+  halo_send_type[TO_BOTTOM] = halo_recv_type[TO_BOTTOM] = types[Y_DIR];
+
+  halo_send_buf[TO_LEFT] = field + (1 * n_y + 1) * size;
+  halo_recv_buf[TO_LEFT] = field + ((dim[X_DIR] - 1) * n_y + 1) * size;
+  halo_send_buf[TO_RIGHT] = field + ((dim[X_DIR] - 2) * n_y + 1) * size;
+  halo_recv_buf[TO_RIGHT] = field + (0 * n_y + 1) * size;
+  halo_send_type[TO_LEFT] = halo_recv_type[TO_LEFT] = types[X_DIR];
+  halo_send_type[TO_RIGHT] = halo_recv_type[TO_RIGHT] = types[X_DIR];
+
+  Setup_Colour_Table(field, size);
+}
+
+/*
+ * The points of colour c of the strip of n points (x + k * dx, y + k * dy)
+ * of a dim[X_DIR] x dim[Y_DIR] field, every other point from the first of
+ * that colour on. For the checkerboard storage they are addressed absolutely.
+ */
+void Colour_Strip_Type(char *field, int size, int x, int y, int dx, int dy, int n, int c,
+                       void **buf, MPI_Datatype *type)
+{
+  int k = (x + y + offset[X_DIR] + offset[Y_DIR] + c) % 2;
+
+  if (efficient_loop_flag == CHECKERBOARD_LOOP)
+  {
+    *buf = MPI_BOTTOM;
+    Checkerboard_Strip_Type(x + k * dx, y + k * dy, 2 * dx, 2 * dy, (n - k + 1) / 2, type);
+    return;
+  }
+  *buf = field + ((x + k * dx) * dim[Y_DIR] + y + k * dy) * size;
+  MPI_Type_vector((n - k + 1) / 2, 1, 2 * (dx * dim[Y_DIR] + dy),
+                  size == sizeof(float) ? MPI_FLOAT : size == sizeof(double) ? MPI_DOUBLE : batch_point_type, type);
+  MPI_Type_commit(type);
+}
+
+/* the colour tables of the borders of the halo table, see halo_colour */
+void Setup_Colour_Table(char *field, int size)
+{
+  int c, n_x = dim[X_DIR], n_y = dim[Y_DIR];
+
+  Free_Colour_Table();
+  for (c = 0; c < 2; c++)
+  {
+    Colour_Strip_Type(field, size, 1, 1, 1, 0, n_x - 2, c,
+                      &halo_colour_send_buf[c][TO_TOP], &halo_colour_send_type[c][TO_TOP]);
+    Colour_Strip_Type(field, size, 1, n_y - 1, 1, 0, n_x - 2, c,
+                      &halo_colour_recv_buf[c][TO_TOP], &halo_colour_recv_type[c][TO_TOP]);
+    Colour_Strip_Type(field, size, 1, n_y - 2, 1, 0, n_x - 2, c,
+                      &halo_colour_send_buf[c][TO_BOTTOM], &halo_colour_send_type[c][TO_BOTTOM]);
+    Colour_Strip_Type(field, size, 1, 0, 1, 0, n_x - 2, c,
+                      &halo_colour_recv_buf[c][TO_BOTTOM], &halo_colour_recv_type[c][TO_BOTTOM]);
+
+    Colour_Strip_Type(field, size, 1, 1, 0, 1, n_y - 2, c,
+                      &halo_colour_send_buf[c][TO_LEFT], &halo_colour_send_type[c][TO_LEFT]);
+    Colour_Strip_Type(field, size, n_x - 1, 1, 0, 1, n_y - 2, c,
+                      &halo_colour_recv_buf[c][TO_LEFT], &halo_colour_recv_type[c][TO_LEFT]);
+    Colour_Strip_Type(field, size, n_x - 2, 1, 0, 1, n_y - 2, c,
+                      &halo_colour_send_buf[c][TO_RIGHT], &halo_colour_send_type[c][TO_RIGHT]);
+    Colour_Strip_Type(field, size, 0, 1, 0, 1, n_y - 2, c,
+                      &halo_colour_recv_buf[c][TO_RIGHT], &halo_colour_recv_type[c][TO_RIGHT]);
+  }
+  halo_colour_ready = 1;
+}
+
+void Free_Colour_Table()
+{
+  int c, i;
+
+  if (!halo_colour_ready)
+    return;
+  for (c = 0; c < 2; c++)
+    for (i = 0; i < 4; i++)
+    {
+      MPI_Type_free(&halo_colour_send_type[c][i]);
+      MPI_Type_free(&halo_colour_recv_type[c][i]);
+    }
+  halo_colour_ready = 0;
+}
+
+/*
+ * A row or column of the grid alternates between the two colour arrays, so the
+ * borders are described by absolute addresses and sent relative to MPI_BOTTOM.
+ */
+void Checkerboard_Strip_Type(int x, int y, int dx, int dy, int n, MPI_Datatype *type)
+{
+  MPI_Aint *displs;
+  int i;
+
+  if ((displs = malloc((n + 1) * sizeof(MPI_Aint))) == NULL)
+    Debug("Checkerboard_Strip_Type : malloc(displs) failed", 1);
+  for (i = 0; i < n; i++)
+    MPI_Get_address(Checkerboard_Point(x + i * dx, y + i * dy), &displs[i]);
+  MPI_Type_create_hindexed_block(n, 1, displs, MPI_DOUBLE, type);
+  MPI_Type_commit(type);
+  free(displs);
+}
+
+void Setup_Checkerboard_Datatypes()
+{
+  int i;
+
+  Halo_Engine_Reset();
+  for (i = 0; i < 4; i++)
+  {
+    halo_send_buf[i] = MPI_BOTTOM;
+    halo_recv_buf[i] = MPI_BOTTOM;
+    halo_blocks[i] = 0;
+  }
+
+  /* vertical data exchange (Y_DIR) */
+  Checkerboard_Strip_Type(1, 1, 1, 0, dim[X_DIR] - 2, &halo_send_type[TO_TOP]);
+  Checkerboard_Strip_Type(1, dim[Y_DIR] - 1, 1, 0, dim[X_DIR] - 2, &halo_recv_type[TO_TOP]);
+  Checkerboard_Strip_Type(1, dim[Y_DIR] - 2, 1, 0, dim[X_DIR] - 2, &halo_send_type[TO_BOTTOM]);
+  Checkerboard_Strip_Type(1, 0, 1, 0, dim[X_DIR] - 2, &halo_recv_type[TO_BOTTOM]);
+
+  /* horizontal data exchange (X_DIR) */
+  Checkerboard_Strip_Type(1, 1, 0, 1, dim[Y_DIR] - 2, &halo_send_type[TO_LEFT]);
+  Checkerboard_Strip_Type(dim[X_DIR] - 1, 1, 0, 1, dim[Y_DIR] - 2, &halo_recv_type[TO_LEFT]);
+  Checkerboard_Strip_Type(dim[X_DIR] - 2, 1, 0, 1, dim[Y_DIR] - 2, &halo_send_type[TO_RIGHT]);
+  Checkerboard_Strip_Type(0, 1, 0, 1, dim[Y_DIR] - 2, &halo_recv_type[TO_RIGHT]);
+
+  Setup_Colour_Table(NULL, sizeof(double));
+}
+
+/*
+ * Borders of halo_width cells of the deep halo copy. The vertical exchange
+ * covers the owned columns, the horizontal one whole rows including the
+ * vertical halos just received, which fills the corners.
+ */
+void Setup_Deep_Halo_Datatypes()
+{
+  int H = halo_width;
+  int n_x = dh_dim[X_DIR] - 2 * H;
+  int n_y = dh_dim[Y_DIR] - 2 * H;
+
+  MPI_Type_vector(n_x, H, dh_dim[Y_DIR], MPI_DOUBLE, &border_type[Y_DIR]);
+  MPI_Type_commit(&border_type[Y_DIR]);
+  MPI_Type_contiguous(H * dh_dim[Y_DIR], MPI_DOUBLE, &border_type[X_DIR]);
+  MPI_Type_commit(&border_type[X_DIR]);
+
+  Halo_Engine_Reset();
+  halo_elem_size = sizeof(double);
+  for (int i = TO_TOP; i <= TO_BOTTOM; i++)
+  {
+    halo_blocks[i] = n_x;
+    halo_blocklen[i] = H;
+    halo_stride[i] = dh_dim[Y_DIR];
+  }
+  for (int i = TO_LEFT; i <= TO_RIGHT; i++)
+  {
+    halo_blocks[i] = 1;
+    halo_blocklen[i] = H * dh_dim[Y_DIR];
+    halo_stride[i] = 0;
+  }
+
+  halo_send_buf[TO_TOP] = &dh_phi[H][H];
+  halo_recv_buf[TO_TOP] = &dh_phi[H][H + n_y];
+  halo_send_buf[TO_BOTTOM] = &dh_phi[H][n_y];
+  halo_recv_buf[TO_BOTTOM] = &dh_phi[H][0];
+  halo_send_type[TO_TOP] = halo_recv_type[TO_TOP] = border_type[Y_DIR];
+  halo_send_type[TO_BOTTOM] = halo_recv_type[TO_BOTTOM] = border_type[Y_DIR];
+
+  halo_send_buf[TO_LEFT] = &dh_phi[H][0];
+  halo_recv_buf[TO_LEFT] = &dh_phi[H + n_x][0];
+  halo_send_buf[TO_RIGHT] = &dh_phi[n_x][0];
+  halo_recv_buf[TO_RIGHT] = &dh_phi[0][0];
+  halo_send_type[TO_LEFT] = halo_recv_type[TO_LEFT] = border_type[X_DIR];
+  halo_send_type[TO_RIGHT] = halo_recv_type[TO_RIGHT] = border_type[X_DIR];
+}
+
+void Exchange_Borders()
+{
+  // Debug("Exchange_Borders", 0);
+  double latency_start = 0.0;
+  int data_size, i;
+  int dest, source;
+  void **send_buf = halo_send_buf, **recv_buf = halo_recv_buf;
+  MPI_Datatype *send_type = halo_send_type, *recv_type = halo_recv_type;
+  if (count % sweep == 0 && halo_engine != HALO_DATATYPE)
+  {
+    if (latency_flag)
+    {
+      MPI_Barrier(grid_comm);
+      latency_start = MPI_Wtime();
+    }
+    Halo_Exchange();
+    if (latency_flag)
+    {
+      latency += MPI_Wtime() - latency_start;
+      for (i = 0; i < 4; i++)
+        if (halo_dest[i] > 0)
+          byte += 2 * halo_send_bytes[i];
+    }
+  }
+  else if (count % sweep == 0)
+  {
+    /* the other colour has not changed since the last exchange */
+    if (halo_colour >= 0 && halo_colour_ready)
+    {
+      send_buf = halo_colour_send_buf[halo_colour];
+      recv_buf = halo_colour_recv_buf[halo_colour];
+      send_type = halo_colour_send_type[halo_colour];
+      recv_type = halo_colour_recv_type[halo_colour];
+    }
+
+    /* top to bottom, bottom to top, left to right and right to left exchange */
+    for (i = 0; i < 4; i++)
+    {
+      if (latency_flag)
+      {
+        if (i == TO_TOP || i == TO_LEFT)
+          MPI_Barrier(grid_comm);
+        latency_start = MPI_Wtime();
+      }
+      dest = halo_dest[i];
+      source = halo_source[i];
+      if (adaptive_fraction > 0.0)
+      {
+        /* the neighbours skip this iteration too, see Adaptive_Decide */
+        if (dest != MPI_PROC_NULL && !adaptive_send)
+        {
+          dest = MPI_PROC_NULL;
+          adaptive_saved++;
+        }
+        if (source != MPI_PROC_NULL && !adaptive_recv[i])
+          source = MPI_PROC_NULL;
+      }
+      MPI_Sendrecv(send_buf[i], 1, send_type[i], dest, 0,
+                   recv_buf[i], 1, recv_type[i], source, 0, grid_comm, &status);
+      if (latency_flag && dest > 0)
+      {
+        latency += MPI_Wtime() - latency_start;
+        MPI_Type_size(send_type[i], &data_size);
+        byte += 2 * data_size;
+      }
+    }
+  }
+}
+
+/* post the exchange of all four borders without waiting for it */
+void Exchange_Borders_Start()
+{
+  int data_size, i;
+  void **send_buf = halo_send_buf, **recv_buf = halo_recv_buf;
+  MPI_Datatype *send_type = halo_send_type, *recv_type = halo_recv_type;
+
+  if (count % sweep == 0)
+  {
+    if (halo_colour >= 0 && halo_colour_ready)
+    {
+      send_buf = halo_colour_send_buf[halo_colour];
+      recv_buf = halo_colour_recv_buf[halo_colour];
+      send_type = halo_colour_send_type[halo_colour];
+      recv_type = halo_colour_recv_type[halo_colour];
+    }
+    for (i = 0; i < 4; i++)
+    {
+      MPI_Irecv(recv_buf[i], 1, recv_type[i], halo_source[i], i, grid_comm, &halo_request[2 * i]);
+      MPI_Isend(send_buf[i], 1, send_type[i], halo_dest[i], i, grid_comm, &halo_request[2 * i + 1]);
+      if (latency_flag && halo_dest[i] > 0)
+      {
+        MPI_Type_size(send_type[i], &data_size);
+        byte += 2 * data_size;
+      }
+    }
+    halo_pending = 1;
+  }
+}
+
+/* complete the exchange posted by Exchange_Borders_Start, if any */
+void Exchange_Borders_Finish()
+{
+  double latency_start;
+  if (halo_pending)
+  {
+    latency_start = MPI_Wtime();
+    MPI_Waitall(8, halo_request, MPI_STATUSES_IGNORE);
+    if (latency_flag)
+      latency += MPI_Wtime() - latency_start;
+    halo_pending = 0;
+  }
+}
+
+/* release the state of the halo exchange backends, the table is about to change */
+void Halo_Engine_Reset()
+{
+  int i;
+
+  if (!halo_ready)
+    return;
+
+  if (halo_engine == HALO_PERSISTENT)
+    for (i = 0; i < 8; i++)
+      MPI_Request_free(&halo_persistent[i]);
+  if (halo_engine == HALO_RMA)
+  {
+    MPI_Win_free(&halo_win);
+    MPI_Group_free(&halo_group[0]);
+    MPI_Group_free(&halo_group[1]);
+  }
+  free(halo_stage);
+  halo_stage = NULL;
+  halo_ready = 0;
+}
+
+/*
+ * Build the state of halo_engine for the current table. Every backend
+ * exchanges the vertical borders (TO_TOP, TO_BOTTOM) before the horizontal
+ * ones, like the datatype loop, so the corners of deep halos are filled.
+ */
+void Halo_Engine_Setup()
+{
+  int i, k, d, n, off = 0;
+  int neighbours[2];
+  int node_rank[2], disp_unit;
+  MPI_Aint recv_off[4], send_off[4], peer_off[4], win_size;
+  MPI_Group grid_group, node_group;
+  char *peer_base;
+
+  for (i = 0; i < 4; i++)
+  {
+    MPI_Type_size(halo_send_type[i], &halo_send_bytes[i]);
+    MPI_Type_size(halo_recv_type[i], &halo_recv_bytes[i]);
+  }
+  for (i = 0; i < 4; i++)
+  {
+    halo_stage_off[i] = off;
+    off += halo_send_bytes[i];
+  }
+  for (i = 0; i < 4; i++)
+  {
+    halo_stage_off[4 + i] = off;
+    off += halo_recv_bytes[i];
+  }
+  if ((halo_stage = malloc(off)) == NULL)
+    Debug("Halo_Engine_Setup : malloc(halo_stage) failed", 1);
+
+  if (halo_engine == HALO_PERSISTENT)
+  {
+    for (i = 0; i < 4; i++)
+    {
+      MPI_Recv_init(halo_recv_buf[i], 1, halo_recv_type[i], halo_source[i], i, grid_comm, &halo_persistent[2 * i]);
+      MPI_Send_init(halo_send_buf[i], 1, halo_send_type[i], halo_dest[i], i, grid_comm, &halo_persistent[2 * i + 1]);
+    }
+  }
+
+  if (halo_engine == HALO_NEIGHBOR)
+  {
+    /* Cartesian neighbour k of grid_comm is left, right, top, bottom, it is
+       sent direction send_dir[k] and receives direction recv_dir[k] from us */
+    int send_dir[4] = {TO_LEFT, TO_RIGHT, TO_TOP, TO_BOTTOM};
+    int recv_dir[4] = {TO_RIGHT, TO_LEFT, TO_BOTTOM, TO_TOP};
+
+    for (d = 0; d < 2; d++)
+      for (k = 0; k < 4; k++)
+      {
+        /* phase 0 exchanges the Y_DIR neighbours 2 and 3 */
+        halo_nb_counts[d][k] = (k / 2 == 1 - d);
+        halo_nb_send_types[d][k] = halo_nb_counts[d][k] ? halo_send_type[send_dir[k]] : MPI_BYTE;
+        halo_nb_recv_types[d][k] = halo_nb_counts[d][k] ? halo_recv_type[recv_dir[k]] : MPI_BYTE;
+        halo_nb_send_displs[d][k] = 0;
+        halo_nb_recv_displs[d][k] = 0;
+        if (halo_send_buf[send_dir[k]] != MPI_BOTTOM)
+          MPI_Get_address(halo_send_buf[send_dir[k]], &halo_nb_send_displs[d][k]);
+        if (halo_recv_buf[recv_dir[k]] != MPI_BOTTOM)
+          MPI_Get_address(halo_recv_buf[recv_dir[k]], &halo_nb_recv_displs[d][k]);
+      }
+  }
+
+  if (halo_engine == HALO_RMA)
+  {
+    /* the window holds the receive slots, neighbours put their borders there */
+    MPI_Win_create(halo_stage + halo_stage_off[4], off - halo_stage_off[4], 1, MPI_INFO_NULL, grid_comm, &halo_win);
+    for (i = 0; i < 4; i++)
+    {
+      recv_off[i] = halo_stage_off[4 + i] - halo_stage_off[4];
+      MPI_Sendrecv(&recv_off[i], 1, MPI_AINT, halo_source[i], 0,
+                   &halo_put_disp[i], 1, MPI_AINT, halo_dest[i], 0, grid_comm, &status);
+    }
+
+    MPI_Comm_group(grid_comm, &grid_group);
+    for (d = 0; d < 2; d++)
+    {
+      n = 0;
+      for (i = 2 * d; i < 2 * d + 2; i++)
+        if (halo_dest[i] != MPI_PROC_NULL)
+          neighbours[n++] = halo_dest[i];
+      MPI_Group_incl(grid_group, n, neighbours, &halo_group[d]);
+    }
+    MPI_Group_free(&grid_group);
+  }
 
-    for (int i = 0; i < sweep_length; i++)
+  if (halo_engine == HALO_SHARED)
+  {
+    /* a border is read in place if it lies in the phi of a process on this
+       node, the others keep the message path */
+    MPI_Comm_group(grid_comm, &grid_group);
+    MPI_Comm_group(node_comm, &node_group);
+    for (i = 0; i < 4; i++)
     {
-      for (int j = 0; j < omega_length; j++)
+      send_off[i] = -1;
+      if (phi_shared && halo_blocks[i] > 0 && (char *)halo_send_buf[i] >= phi_win_base &&
+          (char *)halo_send_buf[i] < phi_win_base + phi_win_size)
+        send_off[i] = (char *)halo_send_buf[i] - phi_win_base;
+      peer_off[i] = -1;
+      MPI_Sendrecv(&send_off[i], 1, MPI_AINT, halo_dest[i], 0,
+                   &peer_off[i], 1, MPI_AINT, halo_source[i], 0, grid_comm, &status);
+      MPI_Sendrecv(&halo_stride[i], 1, MPI_INT, halo_dest[i], 1,
+                   &halo_peer_stride[i], 1, MPI_INT, halo_source[i], 1, grid_comm, &status);
+
+      node_rank[0] = node_rank[1] = MPI_UNDEFINED;
+      if (halo_source[i] != MPI_PROC_NULL)
+        MPI_Group_translate_ranks(grid_group, 1, &halo_source[i], node_group, &node_rank[0]);
+      if (halo_dest[i] != MPI_PROC_NULL)
+        MPI_Group_translate_ranks(grid_group, 1, &halo_dest[i], node_group, &node_rank[1]);
+
+      halo_peer_buf[i] = NULL;
+      if (node_rank[0] != MPI_UNDEFINED && peer_off[i] >= 0)
       {
-        fwrite(&times_sweep_vs_omega[i][j], sizeof(double), 1, f);
+        MPI_Win_shared_query(phi_win, node_rank[0], &win_size, &disp_unit, &peer_base);
+        halo_peer_buf[i] = peer_base + peer_off[i];
       }
+      halo_to_peer[i] = (node_rank[1] != MPI_UNDEFINED && send_off[i] >= 0);
     }
-    fclose(f1);
+    MPI_Group_free(&grid_group);
+    MPI_Group_free(&node_group);
+  }
 
-    generate_fn(fn, "sweep_analysis", "sweeps");
-    FILE *f2 = fopen(fn, "w");
-    if (f2 == NULL)
-      Debug("Error opening sweep file", 1);
+  halo_ready = 1;
+}
 
-    for (int i = 0; i < sweep_length; i++)
-    {
-      fwrite(&sweeps[i], sizeof(int), 1, f2);
-    }
-    fclose(f2);
+/* copy the send border of direction i into buf */
+void Halo_Pack(int i, char *buf)
+{
+  int k, pos = 0;
+  char *src = halo_send_buf[i];
+  int n = halo_blocks[i], len = halo_blocklen[i], stride = halo_stride[i];
 
+  if (n == 0)
+    MPI_Pack(halo_send_buf[i], 1, halo_send_type[i], buf, halo_send_bytes[i], &pos, grid_comm);
+  else if (len == 1 && halo_elem_size == sizeof(double))
+  {
+    double *restrict s = (double *)src, *restrict b = (double *)buf;
+#pragma omp simd
+    for (k = 0; k < n; k++)
+      b[k] = s[k * stride];
+  }
+  else if (len == 1 && halo_elem_size == sizeof(float))
+  {
+    float *restrict s = (float *)src, *restrict b = (float *)buf;
+#pragma omp simd
+    for (k = 0; k < n; k++)
+      b[k] = s[k * stride];
   }
+  else
+    for (k = 0; k < n; k++)
+      memcpy(buf + k * len * halo_elem_size, src + k * stride * halo_elem_size, len * halo_elem_size);
 }
 
-void Latency_Analysis()
+/* copy buf into the receive border of direction i */
+void Halo_Unpack(int i, char *buf)
 {
-  // Debug("Latency_Analysis", 0);
-  double ***out; // holds latencies, bytes per process shape =  2 x P x latency_length
-  int out_size, i, j, p;
+  int k, pos = 0;
+  char *dst = halo_recv_buf[i];
+  int n = halo_blocks[i], len = halo_blocklen[i], stride = halo_stride[i];
 
-  if (proc_rank == 0)
+  if (n == 0)
+    MPI_Unpack(buf, halo_recv_bytes[i], &pos, halo_recv_buf[i], 1, halo_recv_type[i], grid_comm);
+  else if (len == 1 && halo_elem_size == sizeof(double))
+  {
+    double *restrict d = (double *)dst, *restrict b = (double *)buf;
+#pragma omp simd
+    for (k = 0; k < n; k++)
+      d[k * stride] = b[k];
+  }
+  else if (len == 1 && halo_elem_size == sizeof(float))
   {
+    float *restrict d = (float *)dst, *restrict b = (float *)buf;
+#pragma omp simd
+    for (k = 0; k < n; k++)
+      d[k * stride] = b[k];
+  }
+  else
+    for (k = 0; k < n; k++)
+      memcpy(dst + k * stride * halo_elem_size, buf + k * len * halo_elem_size, len * halo_elem_size);
+}
 
-    out_size = 2 * P * latency_length;
-    // Allocate memory for the pointers to the rows
-    if ((out = malloc(2 * sizeof(double **))) == NULL)
-      Debug("Latency_Analysis : malloc(out) failed", 1);
-    if ((out[0] = malloc(P * sizeof(double *))) == NULL)
-      Debug("Latency_Analysis : malloc(out[0]) failed", 1);
-    if ((out[1] = malloc(P * sizeof(double *))) == NULL)
-      Debug("Latency_Analysis : malloc(out[1]) failed", 1);
-    for (i = 0; i < 2; i++)
+/*
+ * shared: copy the send border of direction i of halo_source[i] straight
+ * from its phi into the receive border, its rows may be longer than ours
+ */
+void Halo_Copy(int i)
+{
+  int k;
+  char *src = halo_peer_buf[i], *dst = halo_recv_buf[i];
+  int n = halo_blocks[i], len = halo_blocklen[i];
+  int src_stride = halo_peer_stride[i], dst_stride = halo_stride[i];
+
+  if (len == 1 && halo_elem_size == sizeof(double))
+  {
+    double *restrict s = (double *)src, *restrict d = (double *)dst;
+#pragma omp simd
+    for (k = 0; k < n; k++)
+      d[k * dst_stride] = s[k * src_stride];
+  }
+  else
+    for (k = 0; k < n; k++)
+      memcpy(dst + k * dst_stride * halo_elem_size, src + k * src_stride * halo_elem_size, len * halo_elem_size);
+}
+
+/* one exchange of all four borders with halo_engine, vertical borders first */
+void Halo_Exchange()
+{
+  int d, i, n;
+  MPI_Request requests[4];
+
+  if (!halo_ready)
+    Halo_Engine_Setup();
+
+  for (d = 0; d < 2; d++)
+  {
+    switch (halo_engine)
     {
-      for (p = 0; p < P; p++)
+    case HALO_DATATYPE:
+      for (i = 2 * d; i < 2 * d + 2; i++)
+        MPI_Sendrecv(halo_send_buf[i], 1, halo_send_type[i], halo_dest[i], 0,
+                     halo_recv_buf[i], 1, halo_recv_type[i], halo_source[i], 0, grid_comm, &status);
+      break;
+
+    case HALO_PACK:
+      for (i = 2 * d; i < 2 * d + 2; i++)
       {
-        if ((out[i][p] = malloc(latency_length * sizeof(double))) == NULL)
-          Debug("Latency_Analysis : malloc(out[i][p]) failed", 1);
+        Halo_Pack(i, halo_stage + halo_stage_off[i]);
+        MPI_Irecv(halo_stage + halo_stage_off[4 + i], halo_recv_bytes[i], MPI_BYTE, halo_source[i], i, grid_comm,
+                  &requests[2 * (i - 2 * d)]);
+        MPI_Isend(halo_stage + halo_stage_off[i], halo_send_bytes[i], MPI_BYTE, halo_dest[i], i, grid_comm,
+                  &requests[2 * (i - 2 * d) + 1]);
+      }
+      MPI_Waitall(4, requests, MPI_STATUSES_IGNORE);
+      for (i = 2 * d; i < 2 * d + 2; i++)
+        if (halo_source[i] != MPI_PROC_NULL)
+          Halo_Unpack(i, halo_stage + halo_stage_off[4 + i]);
+      break;
+
+    case HALO_PERSISTENT:
+      MPI_Startall(4, &halo_persistent[4 * d]);
+      MPI_Waitall(4, &halo_persistent[4 * d], MPI_STATUSES_IGNORE);
+      break;
+
+    case HALO_NEIGHBOR:
+      MPI_Neighbor_alltoallw(MPI_BOTTOM, halo_nb_counts[d], halo_nb_send_displs[d], halo_nb_send_types[d],
+                             MPI_BOTTOM, halo_nb_counts[d], halo_nb_recv_displs[d], halo_nb_recv_types[d], grid_comm);
+      break;
+
+    case HALO_RMA:
+      for (i = 2 * d; i < 2 * d + 2; i++)
+        Halo_Pack(i, halo_stage + halo_stage_off[i]);
+      MPI_Win_post(halo_group[d], 0, halo_win);
+      MPI_Win_start(halo_group[d], 0, halo_win);
+      for (i = 2 * d; i < 2 * d + 2; i++)
+        if (halo_dest[i] != MPI_PROC_NULL)
+          MPI_Put(halo_stage + halo_stage_off[i], halo_send_bytes[i], MPI_BYTE, halo_dest[i],
+                  halo_put_disp[i], halo_send_bytes[i], MPI_BYTE, halo_win);
+      MPI_Win_complete(halo_win);
+      MPI_Win_wait(halo_win);
+      for (i = 2 * d; i < 2 * d + 2; i++)
+        if (halo_source[i] != MPI_PROC_NULL)
+          Halo_Unpack(i, halo_stage + halo_stage_off[4 + i]);
+      break;
+
+    case HALO_SHARED:
+      n = 0;
+      for (i = 2 * d; i < 2 * d + 2; i++)
+      {
+        if (halo_peer_buf[i] == NULL)
+          MPI_Irecv(halo_recv_buf[i], 1, halo_recv_type[i], halo_source[i], i, grid_comm, &requests[n++]);
+        if (!halo_to_peer[i])
+          MPI_Isend(halo_send_buf[i], 1, halo_send_type[i], halo_dest[i], i, grid_comm, &requests[n++]);
       }
+      /* the borders of the node-local neighbours are complete */
+      MPI_Win_sync(phi_win);
+      MPI_Barrier(node_comm);
+      MPI_Win_sync(phi_win);
+      for (i = 2 * d; i < 2 * d + 2; i++)
+        if (halo_peer_buf[i] != NULL)
+          Halo_Copy(i);
+      MPI_Waitall(n, requests, MPI_STATUSES_IGNORE);
+      break;
     }
+  }
 
-    for (j = 0; j < latency_length; j++)
-    {
-      out[0][0][j] = latencies[j];
-      out[1][0][j] = bytes[j];
-    }
+  /* no process changes a border until its neighbours have read it */
+  if (halo_engine == HALO_SHARED)
+  {
+    MPI_Win_sync(phi_win);
+    MPI_Barrier(node_comm);
   }
+}
 
-  MPI_Barrier(grid_comm);
+/*
+ * Time HALO_CALIBRATION_ROUNDS exchanges of every backend on the current
+ * table and keep the fastest, the slowest process counts. The halos are
+ * restored afterwards, so the solve starts from the same grid as without
+ * calibration.
+ */
+void Calibrate_Halo()
+{
+  int e, i, r, best, size, pos;
+  double t;
+  char *saved;
 
-  // gather latencies
-  if (proc_rank != 0)
+  size = 0;
+  for (i = 0; i < 4; i++)
   {
-    MPI_Send(latencies, latency_length, MPI_DOUBLE, 0, 0, grid_comm);
+    MPI_Pack_size(1, halo_recv_type[i], grid_comm, &pos);
+    size += pos;
   }
-  else
+  if ((saved = malloc(size)) == NULL)
+    Debug("Calibrate_Halo : malloc(saved) failed", 1);
+  pos = 0;
+  for (i = 0; i < 4; i++)
+    MPI_Pack(halo_recv_buf[i], 1, halo_recv_type[i], saved, size, &pos, grid_comm);
+
+  best = HALO_DATATYPE;
+  for (e = 0; e < N_HALO_ENGINES; e++)
   {
-    for (p = 1; p < P; p++)
-    {
-      MPI_Recv(&out[0][p][0], latency_length, MPI_DOUBLE, p, 0, grid_comm, &status);
-    }
+    Halo_Engine_Reset();
+    halo_engine = e;
+    Halo_Exchange(); /* builds the state of the backend */
+    MPI_Barrier(grid_comm);
+    t = MPI_Wtime();
+    for (r = 0; r < HALO_CALIBRATION_ROUNDS; r++)
+      Halo_Exchange();
+    t = (MPI_Wtime() - t) / HALO_CALIBRATION_ROUNDS;
+    MPI_Allreduce(&t, &halo_times[e], 1, MPI_DOUBLE, MPI_MAX, grid_comm);
+    if (halo_times[e] < halo_times[best])
+      best = e;
   }
+  Halo_Engine_Reset();
+  halo_engine = best;
 
-  MPI_Barrier(grid_comm);
+  pos = 0;
+  for (i = 0; i < 4; i++)
+    MPI_Unpack(saved, size, &pos, halo_recv_buf[i], 1, halo_recv_type[i], grid_comm);
+  free(saved);
 
-  // gather bytes
-  if (proc_rank != 0)
+  if (proc_rank == 0)
   {
-    MPI_Send(bytes, latency_length, MPI_DOUBLE, 0, 0, grid_comm);
+    for (e = 0; e < N_HALO_ENGINES; e++)
+      printf("(%i) Halo exchange %-10s %10.3e s\n", proc_rank, halo_names[e], halo_times[e]);
+    printf("(%i) Using %s halo exchange\n", proc_rank, halo_names[halo_engine]);
   }
+}
+
+/* run omega omegas[i] with sweep sweeps[j] on the current grid size */
+void Run_Config(int j, int i)
+{
+  sweep = sweeps[j];
+  omega = omegas[i];
+
+  /* the deep halo is as wide as two sweeps */
+  if (gridsizes[grid_size_idx] == setup_gridsize && (!deep_halo_flag || sweep == setup_sweep))
+    Reset_Grid();
   else
   {
-    for (p = 1; p < P; p++)
-    {
-      MPI_Recv(&out[1][p][0], latency_length, MPI_DOUBLE, p, 0, grid_comm, &status);
-    }
+    /* nested iteration: the finished grid is the start of the next size */
+    if (warm_start_flag && setup_gridsize >= 0)
+      Save_Warm_Start();
+    if (setup_gridsize >= 0)
+      Clean_Up_Problemdata();
+    if (autotune_flag)
+      Autotune();
+    Setup_Grid();
+    if (warm_phi != NULL)
+      Warm_Start();
+    Setup_MPI_Datatypes();
   }
 
-  MPI_Barrier(grid_comm);
+  start_timer();
 
-  if (proc_rank == 0)
+  Solve();
+
+  stop_timer();
+
+  if (proc_grid_auto && proc_rank == 0 && gridsizes[grid_size_idx] == predicted_gridsize && current_iter > 0)
+    printf("(%i) Process grid %ix%i: predicted %.3e s, measured %.3e s per iteration\n", proc_rank,
+           P_grid[X_DIR], P_grid[Y_DIR], predicted_iter_time, wtime / current_iter);
+
+  /* record the omega the estimation arrived at */
+  if (omega_mode != OMEGA_FIXED)
+    omegas[i] = omega;
+
+  if (write_output_flag)
   {
-    char fn[200];
-    generate_fn(fn, "latency_analysis", "");
-    FILE *f = fopen(fn, "w");
-    if (f == NULL)
-      Debug("Error opening latency file", 1);
+    Write_Grid();
+  }
 
-    for (i = 0; i < 2; i++)
-    {
-      for (p = 0; p < P; p++)
-      {
-        for (j = 0; j < latency_length; j++)
-        {
-          fwrite(&out[i][p][j], sizeof(double), 1, f);
-        }
-      }
-    }
-    fclose(f);
-    // free memory
-    // for (i = 0; i < 2; i++)
-    // {
-    //   for (p = 0; p < P; p++)
-    //   {
-    //     free(out[i][p]);
-    //   }
-    //   free(out[i]);
-    // }
+  if (track_errors)
+  {
+    Error_Analysis();
   }
-}
 
-void timeVIteration()
-{
-  char fn[200];
-  if (proc_rank == 0)
+  if (latency_flag)
   {
-    generate_fn(fn, "timeviters", "");
-    FILE *f = fopen(fn, "w");
-    if (f == NULL)
-      Debug("Error opening timeviter file", 1);
+    Latency_Analysis();
+  }
 
-    for (int i = 0; i < time_by_iteration_size; i++)
-    {
-      fwrite(&time_by_iteration[i], sizeof(double), 1, f);
-    }
-    fclose(f);
+  if (active_set_factor > 0.0)
+  {
+    Tile_Analysis();
   }
-}
 
-void Clean_Up_Problemdata()
-{
-  // Debug("Clean_Up", 0);
+  // benchmarking
+  iters[i] = current_iter;
+  wtimes[i] = wtime;
+  if (adaptive_fraction > 0.0)
+  {
+    messages_saved[i] = adaptive_saved;
+    stale_iters[i] = adaptive_first ? current_iter - adaptive_first : 0;
+  }
+  cpu_util[i] = 100.0 * ticks * (1.0 / CLOCKS_PER_SEC) / wtime;
 
-  free(phi[0]);
-  free(phi);
-  free(source[0]);
-  free(source);
-  // if (latency_flag)
-  // {
-  //   free(latencies);
-  //   free(bytes);
-  // }
+  MPI_Barrier(grid_comm);
 }
 
-void Clean_Up_Metadata()
+/* the counters of the configurations handed out, one per grid size */
+void Setup_Ensemble()
 {
-  // Debug("Clean_Up_Metadata", 0);
+  int world_rank, n = sweep_length * omega_length;
 
-  free(omegas);
-  free(gridsizes);
-  free(iters);
-  free(wtimes);
-  free(cpu_util);
-  free(sweeps);
-  // for (int i = 0; i < sweep_length; i++)
-  // {
-  //   free(iters_sweep_vs_omega[i]);
-  // }
-  // free(iters_sweep_vs_omega);
-  // if (latency_flag)
-  // {
-  //   free(latencies);
-  //   free(bytes);
-  // }
+  MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+  MPI_Win_allocate(world_rank == 0 ? grid_length * sizeof(int) : 0, sizeof(int), MPI_INFO_NULL,
+                   MPI_COMM_WORLD, &config_counter, &config_win);
+  if (world_rank == 0)
+  {
+    MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, config_win);
+    memset(config_counter, 0, grid_length * sizeof(int));
+    MPI_Win_unlock(0, config_win);
+  }
+  MPI_Barrier(MPI_COMM_WORLD);
+
+  if ((ensemble_results = malloc(4 * n * sizeof(double))) == NULL)
+    Debug("Setup_Ensemble : malloc(ensemble_results) failed", 1);
 }
 
-void Setup_MPI_Datatypes()
+/*
+ * Run all configurations c = j * omega_length + i of the current grid size:
+ * every group takes the next one from the counter on world rank 0 when it
+ * is done with the last. Afterwards every process holds the results of the
+ * process with its rank in the group that ran each configuration.
+ */
+void Run_Ensemble()
 {
-  // Debug("Setup_MPI_Datatypes", 0);
+  int c, i, n = sweep_length * omega_length, one = 1, runs = 0;
 
-  /* Datatype for vertical data exchange (Y_DIR) */
-  MPI_Type_vector(dim[X_DIR] - 2, 1, dim[Y_DIR],
-                  MPI_DOUBLE, &border_type[Y_DIR]);
-  MPI_Type_commit(&border_type[Y_DIR]);
+  for (c = 0; c < 4 * n; c++)
+    ensemble_results[c] = 0.0;
 
-  /* Datatype for horizontal data exchange (X_DIR) */
-  MPI_Type_vector(dim[Y_DIR] - 2, 1, 1,
-                  MPI_DOUBLE, &border_type[X_DIR]);
-  MPI_Type_commit(&border_type[X_DIR]);
+  while (1)
+  {
+    if (proc_rank == 0)
+    {
+      MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, config_win);
+      MPI_Fetch_and_op(&one, &c, MPI_INT, 0, grid_size_idx, MPI_SUM, config_win);
+      MPI_Win_unlock(0, config_win);
+    }
+    MPI_Bcast(&c, 1, MPI_INT, 0, grid_comm);
+    if (c >= n)
+      break;
+
+    i = c % omega_length;
+    Run_Config(c / omega_length, i);
+    ensemble_results[c] = iters[i];
+    ensemble_results[n + c] = wtimes[i];
+    ensemble_results[2 * n + c] = cpu_util[i];
+    ensemble_results[3 * n + c] = omegas[i];
+    runs++;
+  }
+
+  /* each configuration was run by exactly one group */
+  MPI_Allreduce(MPI_IN_PLACE, ensemble_results, 4 * n, MPI_DOUBLE, MPI_SUM, ensemble_comm);
+  if (proc_rank == 0)
+    printf("(%i) Group %i ran %i of %i configurations\n", proc_rank, group, runs, n);
 }
 
-void Exchange_Borders()
+/* results of sweep sweeps[j] for Benchmark, as if this group had run them */
+void Ensemble_Results(int j)
 {
-  // Debug("Exchange_Borders", 0);
-  double latency_start;
-  int data_size;
-  if (count % sweep == 0)
+  int i, c, n = sweep_length * omega_length;
+
+  for (i = 0; i < omega_length; i++)
   {
-    if (latency_flag)
-    {
-      // top to bottom and bottom to top exchange
-      MPI_Barrier(grid_comm);
-      latency_start = MPI_Wtime();
-      MPI_Sendrecv(&phi[1][1], 1, border_type[Y_DIR], proc_top, 0,
-                  &phi[1][dim[Y_DIR] - 1], 1, border_type[Y_DIR], proc_bottom, 0, grid_comm, &status);
-      if (proc_top > 0)
-      {
-        latency += MPI_Wtime() - latency_start;
-        // byte += 2 * (dim[X_DIR] - 2) * sizeof(double);
-        MPI_Type_size(border_type[Y_DIR], &data_size);
-        byte += 2 * data_size;
-      }
-      
-      latency_start = MPI_Wtime();
-      MPI_Sendrecv(&phi[1][dim[Y_DIR] - 2], 1, border_type[Y_DIR], proc_bottom, 0,
-                  &phi[1][0], 1, border_type[Y_DIR], proc_top, 0, grid_comm, &status); /*  all  traffic in direction "bottom"        */
-      if (proc_bottom > 0)
-      {
-        latency += MPI_Wtime() - latency_start;
-        // byte += 2 * (dim[X_DIR] - 2) * sizeof(double);
-        MPI_Type_size(border_type[Y_DIR], &data_size);
-        byte += 2 * data_size;
-      }
-      
-      // left to right and right to left exchange
-      MPI_Barrier(grid_comm);
-      latency_start = MPI_Wtime();
-      MPI_Sendrecv(&phi[1][1], 1, border_type[X_DIR], proc_left, 0,
-                  &phi[dim[X_DIR] - 1][1], 1, border_type[X_DIR], proc_right, 0, grid_comm, &status); /* all traffic in direction "left" */
-      if (proc_left > 0)
-      {
-        latency += MPI_Wtime() - latency_start;
-        // byte += 2 * (dim[X_DIR] - 2) * sizeof(double);
-        MPI_Type_size(border_type[X_DIR], &data_size);
-        byte += 2 * data_size;      
-      }
-      
-      latency_start = MPI_Wtime();
-      MPI_Sendrecv(&phi[dim[X_DIR] - 2][1], 1, border_type[X_DIR], proc_right, 0,
-                  &phi[0][1], 1, border_type[X_DIR], proc_left, 0, grid_comm, &status); /* all traffic in the direction "right" */
-      if (proc_right > 0)
-      {
-        latency += MPI_Wtime() - latency_start;
-        // byte += 2 * (dim[X_DIR] - 2) * sizeof(double);
-        MPI_Type_size(border_type[X_DIR], &data_size);
-        byte += 2 * data_size;      
-      }
-    }
-    else
-    {
-      MPI_Sendrecv(&phi[1][1], 1, border_type[Y_DIR], proc_top, 0,
-                  &phi[1][dim[Y_DIR] - 1], 1, border_type[Y_DIR], proc_bottom, 0, grid_comm, &status);
-      MPI_Sendrecv(&phi[1][dim[Y_DIR] - 2], 1, border_type[Y_DIR], proc_bottom, 0,
-                  &phi[1][0], 1, border_type[Y_DIR], proc_top, 0, grid_comm, &status);
-      MPI_Sendrecv(&phi[1][1], 1, border_type[X_DIR], proc_left, 0,
-                  &phi[dim[X_DIR] - 1][1], 1, border_type[X_DIR], proc_right, 0, grid_comm, &status);
-      MPI_Sendrecv(&phi[dim[X_DIR] - 2][1], 1, border_type[X_DIR], proc_right, 0,
-                  &phi[0][1], 1, border_type[X_DIR], proc_left, 0, grid_comm, &status);
-    }
+    c = j * omega_length + i;
+    iters[i] = ensemble_results[c];
+    wtimes[i] = ensemble_results[n + c];
+    cpu_util[i] = ensemble_results[2 * n + c];
+    omegas[i] = ensemble_results[3 * n + c];
   }
 }
 
 int main(int argc, char **argv)
 {
-  MPI_Init(&argc, &argv);
+  int thread_support;
+
+  /* only the master thread of a process communicates */
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &thread_support);
 
   Setup_Proc_Grid(argc, argv);
 
+  if (thread_support < MPI_THREAD_FUNNELED)
+    Debug("ERROR MPI library does not support MPI_THREAD_FUNNELED", 1);
+#ifdef _OPENMP
+  n_threads = omp_get_max_threads();
+  max_threads = n_threads;
+#endif
+  printf("(%i) Threads per rank: %i\n", proc_rank, n_threads);
+
   Get_CLIs(argc, argv);
 
+  Read_Input();
+
+  Select_Proc_Grid();
+
   iters = malloc(omega_length * sizeof(int));
   wtimes = malloc(omega_length * sizeof(double));
   cpu_util = malloc(omega_length * sizeof(double));
+  messages_saved = malloc(omega_length * sizeof(long));
+  stale_iters = malloc(omega_length * sizeof(int));
   iters_sweep_vs_omega = malloc(sweep_length * sizeof(int *));
   times_sweep_vs_omega = malloc(sweep_length * sizeof(double *));
   for (int i = 0; i < sweep_length; i++)
@@ -1165,64 +6092,37 @@ int main(int argc, char **argv)
     times_sweep_vs_omega[i] = malloc(omega_length * sizeof(double));
   }
 
-  if (latency_flag)
-  {
-    latencies = malloc(sizeof(double));
-    bytes = malloc(sizeof(double));
-  }
+  if (track_errors || latency_flag || timeviter_flag || active_set_factor > 0.0)
+    Telemetry_Start();
+
+  if (perf_flag)
+    Perf_Setup();
+
+  if (n_groups > 1)
+    Setup_Ensemble();
 
   for (grid_size_idx = 0; grid_size_idx < grid_length; grid_size_idx++)
   {
+    if (n_groups > 1)
+      Run_Ensemble();
+
     for (int j = 0; j < sweep_length; j++)
     {
-      sweep = sweeps[j];
-      for (int i = 0; i < omega_length; i++)
-      {
-        omega = omegas[i];
-
-        Setup_Grid();
-
-        Setup_MPI_Datatypes();
-
-        start_timer();
-
-        Solve();
-
-        stop_timer();
-
-        if (write_output_flag)
-        {
-          Write_Grid();
-        }
-
-        if (track_errors)
-        {
-          Error_Analysis();
-        }
-
-        if (latency_flag)
-        {
-          Latency_Analysis();
-        }
-
-        // benchmarking
-        iters[i] = current_iter;
-        wtimes[i] = wtime;
-        cpu_util[i] = 100.0 * ticks * (1.0 / CLOCKS_PER_SEC) / wtime;
-
-        MPI_Barrier(grid_comm);
-
-        Clean_Up_Problemdata();
-      }
+      if (n_groups > 1)
+        Ensemble_Results(j);
+      else
+        for (int i = 0; i < omega_length; i++)
+          Run_Config(j, i);
 
       MPI_Barrier(grid_comm);
 
-      if (benchmark_flag == 1)
+      /* all groups hold the same results, the first one writes them */
+      if (benchmark_flag == 1 && group == 0)
       {
         Benchmark();
       }
 
-      if (sweep_length > 1)
+      if (sweep_length > 1 || adaptive_fraction > 0.0)
       {
         if (proc_rank == 0)
         {
@@ -1235,7 +6135,7 @@ int main(int argc, char **argv)
       }
     }
 
-    if (sweep_length > 1)
+    if ((sweep_length > 1 || adaptive_fraction > 0.0) && group == 0)
     {
       Sweep_Analysis();
     }
@@ -1246,6 +6146,33 @@ int main(int argc, char **argv)
     }
   }
 
+  if (setup_gridsize >= 0)
+    Clean_Up_Problemdata();
+  free(input_src);
+  if (batch_size > 0)
+  {
+    for (int b = 0; b < batch_size; b++)
+      free(batch_problem[b]);
+    free(batch_problem);
+    free(batch_active);
+    free(batch_group_active);
+    free(batch_iters);
+    free(batch_error);
+  }
+  if (telemetry_on)
+    Telemetry_Stop();
+  if (perf_flag)
+  {
+    for (int t = 0; t < perf_threads; t++)
+      Perf_Close(&perf_fd[t * PERF_N_EVENTS]);
+    free(perf_fd);
+  }
+  if (n_groups > 1)
+  {
+    MPI_Win_free(&config_win);
+    free(ensemble_results);
+  }
+
   MPI_Finalize();
 
   return 0;
@@ -17,5 +17,9 @@ module load openmpi
 
 cd ~/HPC/hpc-labs/assignment_1/
 
-mpicc ppoisson2.c -o ppoisson2.x
+mpicc -O3 -march=native -mprefer-vector-width=512 -ffp-contract=off -fopenmp -pthread ppoisson2.c ~/HPC/hpc-labs/mpi_functions/getNodeCount.c ~/HPC/hpc-labs/mpi_functions/perfCounters.c -o ppoisson2.x -I ~/HPC/hpc-labs/mpi_functions -lm
+# hybrid runs: one rank per socket/node with --cpus-per-task threads each
+export OMP_NUM_THREADS=$SLURM_CPUS_PER_TASK
+export OMP_PLACES=cores
+export OMP_PROC_BIND=close
 srun ppoisson2.x 4 1 -omega 1.91 -grids 100 1000 100 -latency true
\ No newline at end of file
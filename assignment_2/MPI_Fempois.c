@@ -6,8 +6,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 #include <time.h>
 #include "mpi.h"
+#include "mpifuncs.h"
 
 #define DEBUG 0
 
@@ -76,6 +78,17 @@ Matrixrow *A; /* matrix A */
 double *errors;
 int N_iters;
 
+/* hardware counters (-perf) around the SpMV and the border exchanges of
+   the CG iteration, see mpi_functions/perfCounters.c */
+#define PERF_SPMV 0
+#define PERF_EXCHANGE 1
+int perf_flag = 0;
+int perf_fd[PERF_N_EVENTS];
+long long perf_counts[2][PERF_N_EVENTS];
+double perf_time[2];
+double perf_flops; /* floating point operations of the counted SpMVs */
+double perf_points; /* rows of the counted SpMVs */
+
 void Setup_Proc_Grid();
 void Setup_Grid();
 void Build_ElMatrix(Element el);
@@ -93,6 +106,8 @@ void resume_timer();
 void stop_timer();
 void print_timer();
 void generate_filename(char *fn, char *folder, char *type);
+void Perf_Begin(long long *mark, double *mark_time);
+void Perf_End(int phase, long long *mark, double mark_time);
 
 void start_timer()
 {
@@ -162,6 +177,26 @@ void generate_filename(char *fn, char *folder, char *type)
           N_vert_total, do_adapt, type);
 }
 
+/* counts and time at the start of a counted phase */
+void Perf_Begin(long long *mark, double *mark_time)
+{
+  memset(mark, 0, PERF_N_EVENTS * sizeof(long long));
+  Perf_Read(perf_fd, 1, mark);
+  *mark_time = MPI_Wtime();
+}
+
+/* add the events since Perf_Begin to phase */
+void Perf_End(int phase, long long *mark, double mark_time)
+{
+  long long now[PERF_N_EVENTS] = {0};
+  int k;
+
+  perf_time[phase] += MPI_Wtime() - mark_time;
+  Perf_Read(perf_fd, 1, now);
+  for (k = 0; k < PERF_N_EVENTS; k++)
+    perf_counts[phase][k] += now[k] - mark[k];
+}
+
 void Setup_Proc_Grid()
 {
   FILE *f = NULL;
@@ -535,6 +570,8 @@ void Solve()
   int i, j;
   double *r, *p, *q;
   double a, b, r1, r2 = 1;
+  long long perf_mark[PERF_N_EVENTS];
+  double perf_mark_time = 0.0;
 
   double sub;
 
@@ -601,17 +638,30 @@ void Solve()
     computation_time += MPI_Wtime() - arbitrary_time;
 
     arbitrary_time = MPI_Wtime();
+    if (perf_flag)
+      Perf_Begin(perf_mark, &perf_mark_time);
     Exchange_Borders(p);
+    if (perf_flag)
+      Perf_End(PERF_EXCHANGE, perf_mark, perf_mark_time);
     exchange_time += MPI_Wtime() - arbitrary_time;
 
     /* q = A * p */
     arbitrary_time = MPI_Wtime();
+    if (perf_flag)
+      Perf_Begin(perf_mark, &perf_mark_time);
     for (i = 0; i < N_vert; i++)
     {
       q[i] = 0;
       for (j = 0; j < A[i].Ncol; j++)
         q[i] += A[i].val[j] * p[A[i].col[j]];
     }
+    if (perf_flag)
+    {
+      Perf_End(PERF_SPMV, perf_mark, perf_mark_time);
+      for (i = 0; i < N_vert; i++)
+        perf_flops += 2 * A[i].Ncol;
+      perf_points += N_vert;
+    }
 
     /* a = r1 / (p' * q) */
     sub = 0.0;
@@ -872,6 +922,46 @@ void Benchmark()
     free(out[0]);
     free(out);
   }
+
+  if (perf_flag)
+  {
+    /* per process and phase (SpMV, exchange): the PERF_N_EVENTS counts,
+       the seconds, the GFLOP/s and the memory bytes per matrix row */
+    double counters[2 * (PERF_N_EVENTS + 3)], *all_counters = NULL;
+    int i, k;
+
+    for (i = 0; i < 2; i++)
+    {
+      for (k = 0; k < PERF_N_EVENTS; k++)
+        counters[i * (PERF_N_EVENTS + 3) + k] = perf_counts[i][k];
+      counters[i * (PERF_N_EVENTS + 3) + PERF_N_EVENTS] = perf_time[i];
+      counters[i * (PERF_N_EVENTS + 3) + PERF_N_EVENTS + 1] =
+          (i == PERF_SPMV && perf_time[i] > 0.0) ? perf_flops / perf_time[i] * 1e-9 : 0.0;
+      counters[i * (PERF_N_EVENTS + 3) + PERF_N_EVENTS + 2] =
+          perf_points > 0.0 ? PERF_CACHE_LINE * perf_counts[i][3] / perf_points : 0.0;
+    }
+    printf("(%i) SpMV: %1.6f s, %4.2f GFLOP/s, %.1f bytes/row\n", proc_rank, perf_time[PERF_SPMV],
+           counters[PERF_N_EVENTS + 1], counters[PERF_N_EVENTS + 2]);
+
+    if (proc_rank == 0)
+      if ((all_counters = malloc(P * sizeof(counters))) == NULL)
+        Debug("Benchmark : malloc(all_counters) failed", 1);
+    MPI_Gather(counters, 2 * (PERF_N_EVENTS + 3), MPI_DOUBLE,
+               all_counters, 2 * (PERF_N_EVENTS + 3), MPI_DOUBLE, 0, grid_comm);
+
+    if (proc_rank == 0)
+    {
+      FILE *f;
+      char filename[100];
+      generate_filename(filename, BENCHMARK_FOLDER, "counters");
+      if ((f = fopen(filename, "w")) == NULL)
+        Debug("Benchmark : Can't open counters outputfile", 1);
+      if (fwrite(all_counters, sizeof(counters), P, f) != (size_t)P)
+        Debug("Benchmark : Error during writing", 1);
+      fclose(f);
+      free(all_counters);
+    }
+  }
 }
 
 void Error_Analysis()
@@ -920,8 +1010,15 @@ int main(int argc, char **argv)
 {
   MPI_Init(&argc, &argv);
 
+  for (int l = 1; l < argc; l++)
+    if (strcmp(argv[l], "-perf") == 0)
+      perf_flag = 1;
+
   Setup_Proc_Grid();
 
+  if (perf_flag && Perf_Open(perf_fd) < PERF_N_EVENTS)
+    printf("(%i) Not all hardware counters are available, the others read 0\n", proc_rank);
+
   Setup_Grid();
 
   start_timer();
@@ -936,6 +1033,9 @@ int main(int argc, char **argv)
 
   Clean_Up();
 
+  if (perf_flag)
+    Perf_Close(perf_fd);
+
   Debug("MPI_Finalize", 0);
 
   MPI_Finalize();
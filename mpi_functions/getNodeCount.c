@@ -2,6 +2,23 @@
 #include <mpi.h>
 #include "mpifuncs.h"
 
+/*
+Function to get the communicator of the processes of comm that share memory
+with the calling process, i.e. that run on the same node
+*/
+MPI_Comm MPI_getNodeComm(MPI_Comm comm)
+{
+    int rank;
+    MPI_Comm shmcomm;
+
+    MPI_Comm_rank(comm, &rank);
+
+    MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, rank,
+                        MPI_INFO_NULL, &shmcomm);
+
+    return shmcomm;
+}
+
 /*
 Function to get the number of nodes from MPI_COMM_WORLD
 obtained from: https://stackoverflow.com/questions/34115227/how-to-get-the-number-of-physical-machine-in-mpi
@@ -11,8 +28,7 @@ int MPI_getNodeCount(void)
     int rank, is_rank0, nodes;
     MPI_Comm shmcomm;
 
-    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0,
-                        MPI_INFO_NULL, &shmcomm);
+    shmcomm = MPI_getNodeComm(MPI_COMM_WORLD);
 
     MPI_Comm_rank(shmcomm, &rank);
 
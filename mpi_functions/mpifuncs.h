@@ -1 +1,9 @@
-int MPI_getNodeCount(void);
\ No newline at end of file
+MPI_Comm MPI_getNodeComm(MPI_Comm comm);
+int MPI_getNodeCount(void);
+
+/* hardware counters of perfCounters.c: cycles, instructions, LLC references, LLC misses */
+#define PERF_N_EVENTS 4
+#define PERF_CACHE_LINE 64
+int Perf_Open(int *fd);
+void Perf_Read(int *fd, int n_threads, long long *values);
+void Perf_Close(int *fd);
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <mpi.h>
+#include "mpifuncs.h"
+
+/*
+Functions to count hardware events of the calling thread with perf_event_open(2):
+cycles, instructions, last level cache references and last level cache misses
+(the misses times the cache line size approximate the memory traffic).
+A counter the kernel or the CPU does not provide keeps fd -1 and reads as 0.
+*/
+static unsigned long long perf_configs[PERF_N_EVENTS] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_REFERENCES,
+    PERF_COUNT_HW_CACHE_MISSES};
+
+int Perf_Open(int *fd)
+{
+    int k, n_open = 0;
+    struct perf_event_attr attr;
+
+    for (k = 0; k < PERF_N_EVENTS; k++)
+    {
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = perf_configs[k];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        /* this thread on any cpu */
+        fd[k] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fd[k] >= 0)
+            n_open++;
+    }
+
+    return n_open;
+}
+
+/*
+Function to add the counts of the counters of n_threads threads,
+fd[t * PERF_N_EVENTS + k] is counter k of thread t, to values[k]
+*/
+void Perf_Read(int *fd, int n_threads, long long *values)
+{
+    int t, k;
+    long long count;
+
+    for (t = 0; t < n_threads; t++)
+        for (k = 0; k < PERF_N_EVENTS; k++)
+            if (fd[t * PERF_N_EVENTS + k] >= 0 &&
+                read(fd[t * PERF_N_EVENTS + k], &count, sizeof(count)) == sizeof(count))
+                values[k] += count;
+}
+
+void Perf_Close(int *fd)
+{
+    int k;
+
+    for (k = 0; k < PERF_N_EVENTS; k++)
+        if (fd[k] >= 0)
+            close(fd[k]);
+}